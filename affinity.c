@@ -0,0 +1,43 @@
+/* cpu_set_t and pthread_setaffinity_np are GNU extensions, csapp.h can't live with _GNU_SOURCE so it is not included here */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "affinity.h"
+
+int affinity_ncpus(void)
+{
+    cpu_set_t set;
+    int n;
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        return 1;
+    n = CPU_COUNT(&set);
+    return n > 0 ? n : 1;
+}
+
+int affinity_pin(int cpu)
+{
+    cpu_set_t allowed, set;
+    int i, n, err;
+
+    // count within the CPUs we are allowed on, a taskset'ed proxy must not pin outside its set
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return -1;
+    if ((n = CPU_COUNT(&allowed)) == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    cpu %= n;
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &allowed) && cpu-- == 0)
+            break;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(i, &set);
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+        errno = err;
+        return -1;
+    }
+    return i;
+}
@@ -0,0 +1,18 @@
+/* $begin affinity.h */
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+/**
+ * number of CPUs the process may run on, at least 1
+ */
+int affinity_ncpus(void);
+
+/**
+ * pin the calling thread to one CPU
+ * @param cpu index into the CPUs the process may run on, taken modulo their count
+ * @return the CPU number the thread now runs on, -1 with errno set on failure
+ */
+int affinity_pin(int cpu);
+
+#endif /* __AFFINITY_H__ */
+/* $end affinity.h */
@@ -0,0 +1,75 @@
+#include "arena.h"
+
+/* Allocations are aligned like malloc's */
+#define ARENA_ALIGN 16
+#define ARENA_HDR ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+static char *arena_block_data(arena_block_t *b)
+{
+    return (char *) b + ARENA_HDR;
+}
+
+void arena_init(arena_t *a, bufpool_t *pool)
+{
+    a->pool = pool;
+    a->first = a->cur = NULL;
+    a->used = 0;
+}
+
+void *arena_alloc(arena_t *a, size_t n)
+{
+    arena_block_t *b;
+    size_t cap;
+    void *p;
+
+    n = (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (a->cur != NULL && a->cur->size - a->used >= n) {
+        p = arena_block_data(a->cur) + a->used;
+        a->used += n;
+        return p;
+    }
+    // blocks kept by arena_reset are reused in order before new ones are taken
+    for (b = a->cur != NULL ? a->cur->next : a->first; b != NULL && b->size < n; b = b->next);
+    if (b == NULL) {
+        b = (arena_block_t *) bufpool_get(a->pool, ARENA_HDR + (n > ARENA_BLOCK_SIZE - ARENA_HDR ? n : ARENA_BLOCK_SIZE - ARENA_HDR), &cap);
+        b->size = cap - ARENA_HDR;
+        // new blocks go behind cur so that the ones still unused stay ahead of it
+        if (a->cur != NULL) {
+            b->next = a->cur->next;
+            a->cur->next = b;
+        } else {
+            b->next = a->first;
+            a->first = b;
+        }
+    }
+    a->cur = b;
+    a->used = n;
+    return arena_block_data(b);
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n)
+{
+    char *p = arena_alloc(a, n + 1);
+
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+void arena_reset(arena_t *a)
+{
+    a->cur = NULL;
+    a->used = 0;
+}
+
+void arena_release(arena_t *a)
+{
+    arena_block_t *b;
+
+    while ((b = a->first) != NULL) {
+        a->first = b->next;
+        bufpool_put(a->pool, (char *) b, b->size + ARENA_HDR);
+    }
+    a->cur = NULL;
+    a->used = 0;
+}
@@ -0,0 +1,52 @@
+/* $begin arena.h */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "csapp.h"
+#include "bufpool.h"
+
+/* Size of the blocks an arena takes from its buffer pool */
+#define ARENA_BLOCK_SIZE 4096
+
+typedef struct arena_block_t {
+    struct arena_block_t *next;
+    size_t size;                /* bytes usable behind the header */
+} arena_block_t;
+
+/**
+ * bump allocator for everything a request produces while it is parsed and
+ * forwarded. Allocations are never freed one by one, arena_reset drops all
+ * of them at once and keeps the blocks for the next request, arena_release
+ * hands the blocks back to the pool they came from.
+ */
+typedef struct arena_t {
+    bufpool_t *pool;
+    arena_block_t *first;       /* every block taken so far, in order */
+    arena_block_t *cur;         /* block allocations are bumped from */
+    size_t used;                /* bytes of cur handed out */
+} arena_t;
+
+void arena_init(arena_t *a, bufpool_t *pool);
+
+/**
+ * n bytes aligned for any type, valid until the next arena_reset/arena_release
+ */
+void *arena_alloc(arena_t *a, size_t n);
+
+/**
+ * copy n bytes of s into the arena and NUL terminate them
+ */
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+
+/**
+ * forget every allocation in O(1), the blocks stay with the arena
+ */
+void arena_reset(arena_t *a);
+
+/**
+ * forget every allocation and give the blocks back to the pool
+ */
+void arena_release(arena_t *a);
+
+#endif /* __ARENA_H__ */
+/* $end arena.h */
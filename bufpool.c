@@ -0,0 +1,85 @@
+#include "bufpool.h"
+
+/* Size class of a capacity, -1 for buffers beyond the largest class */
+static int bufpool_class(size_t cap)
+{
+    int c = 0;
+
+    while (c < BUFPOOL_CLASSES && ((size_t) 1 << (BUFPOOL_MIN_SHIFT + c)) < cap)
+        c++;
+    return c < BUFPOOL_CLASSES ? c : -1;
+}
+
+void bufpool_init(bufpool_t *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+}
+
+void bufpool_deinit(bufpool_t *pool)
+{
+    void *buf;
+    int c;
+
+    for (c = 0; c < BUFPOOL_CLASSES; c++) {
+        while ((buf = pool->free[c]) != NULL) {
+            pool->free[c] = *(void **) buf;
+            Free(buf);
+        }
+        pool->nfree[c] = 0;
+    }
+}
+
+char *bufpool_get(bufpool_t *pool, size_t n, size_t *cap)
+{
+    int c = bufpool_class(n);
+    void *buf;
+
+    if (c < 0) {
+        // too big to be worth keeping around
+        *cap = n;
+        return Malloc(n);
+    }
+    *cap = (size_t) 1 << (BUFPOOL_MIN_SHIFT + c);
+    if ((buf = pool->free[c]) != NULL) {
+        pool->free[c] = *(void **) buf;
+        pool->nfree[c]--;
+        return buf;
+    }
+    return Malloc(*cap);
+}
+
+void bufpool_put(bufpool_t *pool, char *buf, size_t cap)
+{
+    int c;
+
+    if (buf == NULL)
+        return;
+    c = bufpool_class(cap);
+    // only exact class sizes are pooled, they are what bufpool_get hands out
+    if (c < 0 || cap != ((size_t) 1 << (BUFPOOL_MIN_SHIFT + c)) || pool->nfree[c] >= BUFPOOL_KEEP) {
+        Free(buf);
+        return;
+    }
+    *(void **) buf = pool->free[c];
+    pool->free[c] = buf;
+    pool->nfree[c]++;
+}
+
+char *bufpool_grow(bufpool_t *pool, char *buf, size_t len, size_t *cap, size_t n)
+{
+    size_t new_cap;
+    char *new_buf;
+
+    if (buf != NULL && *cap >= n)
+        return buf;
+    // at least double so a buffer growing byte by byte moves only log(n) times
+    if (buf != NULL && n < *cap * 2)
+        n = *cap * 2;
+    new_buf = bufpool_get(pool, n, &new_cap);
+    if (buf != NULL) {
+        memcpy(new_buf, buf, len);
+        bufpool_put(pool, buf, *cap);
+    }
+    *cap = new_cap;
+    return new_buf;
+}
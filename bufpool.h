@@ -0,0 +1,53 @@
+/* $begin bufpool.h */
+#ifndef __BUFPOOL_H__
+#define __BUFPOOL_H__
+
+#include "csapp.h"
+
+/* Buffer sizes are powers of two from 1 << BUFPOOL_MIN_SHIFT up to 1 << BUFPOOL_MAX_SHIFT */
+#define BUFPOOL_MIN_SHIFT 12
+#define BUFPOOL_MAX_SHIFT 20
+#define BUFPOOL_CLASSES (BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+
+/* Free buffers kept per size class, the rest goes back to malloc */
+#define BUFPOOL_KEEP 32
+
+/**
+ * per-thread pool of reusable byte buffers, a buffer is handed out with the
+ * smallest power of two capacity that fits the request and grows by moving
+ * to the next class. Free buffers are linked through their own first bytes.
+ * Not thread safe, every worker owns one.
+ */
+typedef struct bufpool_t {
+    void *free[BUFPOOL_CLASSES];
+    int nfree[BUFPOOL_CLASSES];
+} bufpool_t;
+
+void bufpool_init(bufpool_t *pool);
+
+/**
+ * release every pooled buffer, buffers handed out stay valid
+ */
+void bufpool_deinit(bufpool_t *pool);
+
+/**
+ * take a buffer holding at least n bytes
+ * @param cap set to the real capacity of the buffer
+ */
+char *bufpool_get(bufpool_t *pool, size_t n, size_t *cap);
+
+/**
+ * give buf (capacity cap, as returned by bufpool_get) back, NULL is ignored
+ */
+void bufpool_put(bufpool_t *pool, char *buf, size_t cap);
+
+/**
+ * make buf hold at least n bytes keeping its first len bytes, a NULL buf
+ * is allocated
+ * @param cap capacity of buf, updated
+ * @return buf or the buffer that replaced it
+ */
+char *bufpool_grow(bufpool_t *pool, char *buf, size_t len, size_t *cap, size_t n);
+
+#endif /* __BUFPOOL_H__ */
+/* $end bufpool.h */
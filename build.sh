@@ -1,2 +1,2 @@
 #!/bin/sh 
-make clean &&  gcc -g -Wall -c sbuf.c sbuf.h && make &&  gcc -g -Wall proxy.o cache.o csapp.o sbuf.o -o proxy -lpthread
+make clean &&  gcc -g -Wall -c sbuf.c sbuf.h && make &&  gcc -g -Wall proxy.o cache.o csapp.o sbuf.o event.o uring.o connpool.o connector.o dnscache.o splicer.o affinity.o coro.o bufpool.o arena.o hdrscan.o hdrtab.o reqparse.o respparse.o chunk.o hpack.o h2.o -o proxy -lpthread
@@ -0,0 +1,128 @@
+#include <ctype.h>
+#include <string.h>
+#include "chunk.h"
+
+void chunk_init(chunk_t *c)
+{
+    c->state = CHUNK_SIZE;
+    c->left = 0;
+    c->digits = 0;
+    c->done = 0;
+}
+
+size_t chunk_decode(chunk_t *c, const char *buf, size_t n, char *out, size_t *out_n)
+{
+    size_t i = 0, o = 0, k;
+    int ch;
+
+    while (i < n && !c->done) {
+        ch = (unsigned char) buf[i];
+        switch (c->state) {
+        case CHUNK_SIZE:
+            if (isxdigit(ch) && c->left < ((size_t) -1 >> 4)) {
+                c->left = c->left * 16 + (isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10);
+                c->digits++;
+            } else if (c->digits == 0) {
+                /* a size line without a size is not the last chunk */
+                c->state = CHUNK_ERROR;
+                continue;
+            } else if (ch == '\n') {
+                c->state = c->left > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+            } else if (ch == ';' || ch == '\r' || ch == ' ' || ch == '\t') {
+                c->state = CHUNK_EXT;
+            } else {
+                c->state = CHUNK_ERROR;
+                continue;
+            }
+            i++;
+            break;
+        case CHUNK_EXT:
+            if (ch == '\n')
+                c->state = c->left > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+            i++;
+            break;
+        case CHUNK_DATA:
+            k = n - i < c->left ? n - i : c->left;
+            /* in place o <= i, the regions may overlap */
+            if (out != NULL && out + o != buf + i)
+                memmove(out + o, buf + i, k);
+            o += k;
+            i += k;
+            c->left -= k;
+            if (c->left == 0)
+                c->state = CHUNK_DATA_END;
+            break;
+        case CHUNK_DATA_END:
+        case CHUNK_DATA_LF:
+            if (ch == '\n') {
+                c->state = CHUNK_SIZE;
+                c->digits = 0;
+            } else if (ch == '\r' && c->state == CHUNK_DATA_END) {
+                c->state = CHUNK_DATA_LF;
+            } else {
+                /* more data than the size said, the framing can't be trusted */
+                c->state = CHUNK_ERROR;
+                continue;
+            }
+            i++;
+            break;
+        case CHUNK_TRAILER:
+            if (ch == '\n')
+                c->done = 1;
+            else if (ch != '\r')
+                c->state = CHUNK_TRAILER_LINE;
+            i++;
+            break;
+        case CHUNK_TRAILER_LINE:
+            if (ch == '\n')
+                c->state = CHUNK_TRAILER;
+            i++;
+            break;
+        default:
+            /* no framing to follow any more, the rest goes on as it is */
+            if (out != NULL && out + o != buf + i)
+                memmove(out + o, buf + i, n - i);
+            o += n - i;
+            i = n;
+            break;
+        }
+    }
+    if (out_n != NULL)
+        *out_n = o;
+    return i;
+}
+
+void chunk_skip(chunk_t *c, size_t n)
+{
+    c->left -= n;
+    if (c->left == 0)
+        c->state = CHUNK_DATA_END;
+}
+
+size_t chunk_head(char *buf, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    char tmp[CHUNK_HEAD_MAX];
+    size_t len = 0, i;
+
+    do {
+        tmp[len++] = hex[n & 15];
+        n >>= 4;
+    } while (n > 0);
+    for (i = 0; i < len; i++)
+        buf[i] = tmp[len - 1 - i];
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return len;
+}
+
+size_t chunk_encode(char *buf, size_t n)
+{
+    char line[CHUNK_HEAD_MAX];
+    size_t h = chunk_head(line, n);
+
+    memmove(buf + h, buf, n);
+    memcpy(buf, line, h);
+    memcpy(buf + h + n, CHUNK_TAIL, CHUNK_TAIL_LEN);
+    return h + n + CHUNK_TAIL_LEN;
+}
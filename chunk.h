@@ -0,0 +1,76 @@
+/* $begin chunk.h */
+#ifndef __CHUNK_H__
+#define __CHUNK_H__
+
+#include <stddef.h>
+
+/* Longest chunk size line chunk_head writes: 16 hex digits and CRLF */
+#define CHUNK_HEAD_MAX 18
+
+/* What follows the data of every chunk */
+#define CHUNK_TAIL "\r\n"
+#define CHUNK_TAIL_LEN 2
+
+/* Last chunk without trailers, ends a chunked body */
+#define CHUNK_LAST "0\r\n\r\n"
+#define CHUNK_LAST_LEN 5
+
+/* states of the incremental chunked framing decoder, see chunk_decode */
+typedef enum chunk_state_t {
+    CHUNK_SIZE,         /* hex chunk size */
+    CHUNK_EXT,          /* chunk extension up to the end of the size line */
+    CHUNK_DATA,         /* left data bytes */
+    CHUNK_DATA_END,     /* CRLF (or a bare LF) behind the chunk data */
+    CHUNK_DATA_LF,      /* LF after the CR behind the chunk data */
+    CHUNK_TRAILER,      /* start of a trailer line, an empty one ends the body */
+    CHUNK_TRAILER_LINE, /* inside a trailer field */
+    CHUNK_ERROR         /* not valid chunked framing, body runs until EOF */
+} chunk_state_t;
+
+/**
+ * position inside a chunked body. The body may arrive in pieces of any
+ * size, each chunk_decode goes on where the last one stopped.
+ */
+typedef struct chunk_t {
+    chunk_state_t state;
+    size_t left;        /* data bytes left in the current chunk */
+    int digits;         /* hex digits of the current size line so far */
+    int done;           /* empty line behind the last chunk seen */
+} chunk_t;
+
+void chunk_init(chunk_t *c);
+
+/**
+ * follow the chunked framing over the next n body bytes and, when out is
+ * not NULL, copy the chunk data bytes to out without their framing
+ * @param buf next bytes of the body
+ * @param out at least n bytes, may be buf itself to decode in place
+ * @param out_n set to the data bytes written to out
+ * @return number of bytes of buf that still belong to the body, c->done is
+ *         set once the empty line behind the last chunk has been seen.
+ *         On broken framing every byte belongs to the body and is copied
+ *         to out as it is.
+ */
+size_t chunk_decode(chunk_t *c, const char *buf, size_t n, char *out, size_t *out_n);
+
+/**
+ * n data bytes of the current chunk were moved without chunk_decode (spliced)
+ */
+void chunk_skip(chunk_t *c, size_t n);
+
+/**
+ * write the size line of a chunk of n data bytes to buf
+ * @param buf CHUNK_HEAD_MAX bytes
+ * @return length of the line
+ */
+size_t chunk_head(char *buf, size_t n);
+
+/**
+ * turn the n data bytes at buf into one chunk in place
+ * @param buf needs CHUNK_HEAD_MAX + CHUNK_TAIL_LEN spare bytes behind n
+ * @return length of the chunk
+ */
+size_t chunk_encode(char *buf, size_t n);
+
+#endif /* __CHUNK_H__ */
+/* $end chunk.h */
@@ -0,0 +1,208 @@
+#include "connector.h"
+
+static void attempt_handler(event_handler_t *eh, unsigned int events);
+static void connector_timer_handler(event_handler_t *eh, unsigned int events);
+
+static long connector_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Release attempts, timer and addresses, keep only the winner fd if any */
+static void connector_release(connector_t *c, event_handler_t *winner)
+{
+    int i;
+
+    for (i = 0; i < CONNECTOR_MAX_ATTEMPTS; i++) {
+        if (c->attempts[i].fd < 0)
+            continue;
+        if (&c->attempts[i] == winner)
+            event_del(c->loop, winner);
+        else
+            event_close(c->loop, &c->attempts[i]);
+    }
+    if (c->timer.fd >= 0)
+        event_close(c->loop, &c->timer);
+    Free(c->order);
+    c->order = NULL;
+    c->active = 0;
+    c->running = 0;
+}
+
+static void connector_finish(connector_t *c, event_handler_t *winner)
+{
+    int fd = -1;
+
+    if (winner != NULL) {
+        fd = winner->fd;
+        connector_release(c, winner);
+        winner->fd = -1;
+    } else {
+        connector_release(c, NULL);
+    }
+    c->callback(c, fd);
+}
+
+/* Start connecting to the next address, returns 1 when an attempt is in flight or won */
+static int connector_try_next(connector_t *c)
+{
+    event_handler_t *eh = NULL;
+    struct sockaddr_storage *addr;
+    socklen_t len;
+    int i, fd;
+
+    for (i = 0; i < CONNECTOR_MAX_ATTEMPTS; i++) {
+        if (c->attempts[i].fd < 0) {
+            eh = &c->attempts[i];
+            break;
+        }
+    }
+    while (eh != NULL && c->next < c->naddrs) {
+        addr = &c->order[c->next++];
+        len = addr->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        if ((fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+            c->error = errno;
+            continue;
+        }
+        if (connect(fd, (struct sockaddr *) addr, len) < 0 && errno != EINPROGRESS) {
+            c->error = errno;
+            close(fd);
+            continue;
+        }
+        // even an immediate connect reports writable, one path handles both
+        eh->fd = fd;
+        if (event_add(c->loop, eh, EVENT_WRITE) < 0) {
+            c->error = errno;
+            close(fd);
+            eh->fd = -1;
+            continue;
+        }
+        c->active++;
+        return 1;
+    }
+    return 0;
+}
+
+/* One attempt failed, race the next address right away or give up when nothing is left */
+static void connector_failed(connector_t *c)
+{
+    if (!connector_try_next(c) && c->active == 0) {
+        fprintf(stderr, "#connector_failed every address failed: %s\n", strerror(c->error));
+        connector_finish(c, NULL);
+    }
+}
+
+static void attempt_handler(event_handler_t *eh, unsigned int events)
+{
+    connector_t *c = (connector_t *) eh->data;
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (!c->running || eh->fd < 0)
+        return;
+    if (getsockopt(eh->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+    if (err == 0 && !(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        return;
+    if (err == 0 && (events & EPOLLOUT)) {
+        struct sockaddr_storage peer;
+        socklen_t plen = sizeof(peer);
+
+        // a readiness report may predate the socket now in this slot, make sure it is connected
+        if (getpeername(eh->fd, (struct sockaddr *) &peer, &plen) < 0 && errno == ENOTCONN)
+            return;
+        connector_finish(c, eh);
+        return;
+    }
+    c->error = err ? err : ECONNREFUSED;
+    event_close(c->loop, eh);
+    c->active--;
+    connector_failed(c);
+}
+
+static void connector_timer_handler(event_handler_t *eh, unsigned int events)
+{
+    connector_t *c = (connector_t *) eh->data;
+    uint64_t expirations;
+
+    while (read(eh->fd, &expirations, sizeof(expirations)) > 0);
+    if (!c->running)
+        return;
+    if (connector_now() >= c->deadline) {
+        fprintf(stderr, "#connector_timer_handler connect timed out\n");
+        c->error = ETIMEDOUT;
+        connector_finish(c, NULL);
+        return;
+    }
+    // the attempts in flight are slow, let the next address join the race
+    connector_try_next(c);
+}
+
+int connector_start(connector_t *c, event_loop_t *loop, const struct sockaddr_storage *addrs, int naddrs,
+                    int port, int timeout_ms)
+{
+    int i, k, first, want, i4 = 0, i6 = 0;
+
+    c->loop = loop;
+    c->order = NULL;
+    c->naddrs = c->next = c->active = 0;
+    c->error = EHOSTUNREACH;
+    c->running = 0;
+    for (i = 0; i < CONNECTOR_MAX_ATTEMPTS; i++) {
+        c->attempts[i].fd = -1;
+        c->attempts[i].callback = attempt_handler;
+        c->attempts[i].data = c;
+    }
+    c->timer.fd = -1;
+    c->timer.callback = connector_timer_handler;
+    c->timer.data = c;
+    if (naddrs <= 0)
+        return -1;
+
+    // interleave the families, starting with the family the resolver put first
+    c->order = Malloc(naddrs * sizeof(struct sockaddr_storage));
+    first = addrs[0].ss_family;
+    for (k = 0; k < naddrs; k++) {
+        want = (k % 2 == 0) ? first : (first == AF_INET ? AF_INET6 : AF_INET);
+        for (i = want == AF_INET ? i4 : i6; i < naddrs && addrs[i].ss_family != want; i++);
+        if (i == naddrs) {
+            // this family is used up, take the next one of the other family
+            want = want == AF_INET ? AF_INET6 : AF_INET;
+            for (i = want == AF_INET ? i4 : i6; i < naddrs && addrs[i].ss_family != want; i++);
+        }
+        if (i == naddrs)
+            break;
+        c->order[c->naddrs] = addrs[i];
+        if (want == AF_INET6)
+            ((struct sockaddr_in6 *) &c->order[c->naddrs])->sin6_port = htons((unsigned short) port);
+        else
+            ((struct sockaddr_in *) &c->order[c->naddrs])->sin_port = htons((unsigned short) port);
+        c->naddrs++;
+        if (want == AF_INET)
+            i4 = i + 1;
+        else
+            i6 = i + 1;
+    }
+    if (c->naddrs == 0) {
+        Free(c->order);
+        c->order = NULL;
+        c->error = EAFNOSUPPORT;
+        return -1;
+    }
+
+    c->deadline = connector_now() + timeout_ms;
+    c->running = 1;
+    if (event_add_timer(loop, &c->timer, CONNECTOR_ATTEMPT_DELAY) < 0)
+        unix_error("connector_start event_add_timer error");
+    connector_failed(c);
+    return 0;
+}
+
+void connector_cancel(connector_t *c)
+{
+    if (c->running)
+        connector_release(c, NULL);
+}
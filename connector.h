@@ -0,0 +1,63 @@
+/* $begin connector.h */
+#ifndef __CONNECTOR_H__
+#define __CONNECTOR_H__
+
+#include "csapp.h"
+#include "event.h"
+
+/* Parallel connection attempts of one connector at most */
+#define CONNECTOR_MAX_ATTEMPTS 4
+/* ms to wait for an attempt before racing the next address (RFC 8305 suggests 250) */
+#define CONNECTOR_ATTEMPT_DELAY 250
+/* Default ms after which the whole connect gives up */
+#define CONNECTOR_TIMEOUT 3000
+
+typedef struct connector_t connector_t;
+
+/**
+ * callback invoked once the connector is done
+ * @param c the connector
+ * @param fd connected non-blocking socket owned by the callee, -1 on failure
+ *           with c->error telling why
+ */
+typedef void (*connector_callback_t)(connector_t *c, int fd);
+
+/**
+ * non-blocking connect to one of a host's addresses driven by an event loop.
+ * The addresses are tried Happy-Eyeballs style: families interleaved, a new
+ * attempt every CONNECTOR_ATTEMPT_DELAY ms (or as soon as one fails) while
+ * earlier ones keep running, the first socket to connect wins.
+ * Usually embedded in the object waiting for the connection.
+ */
+struct connector_t {
+    event_loop_t *loop;
+    struct sockaddr_storage *order; /* addresses in the order they are tried */
+    int naddrs;
+    int next;                     /* next address in order to try */
+    int active;                   /* attempts in flight */
+    event_handler_t attempts[CONNECTOR_MAX_ATTEMPTS];
+    event_handler_t timer;        /* starts delayed attempts, enforces the deadline */
+    long deadline;                /* CLOCK_MONOTONIC ms */
+    int error;                    /* errno of the last failure */
+    int running;
+    connector_callback_t callback;
+    void *data;                   /* owner of this connector */
+};
+
+/**
+ * start connecting to port on one of the naddrs AF_INET/AF_INET6 addresses,
+ * callback is called from the loop (or before connector_start returns if
+ * every address fails right away)
+ * @return 0 when started, -1 when there is no usable address
+ */
+int connector_start(connector_t *c, event_loop_t *loop, const struct sockaddr_storage *addrs, int naddrs,
+                    int port, int timeout_ms);
+
+/**
+ * abort a running connector and release everything it holds, the callback
+ * is not invoked
+ */
+void connector_cancel(connector_t *c);
+
+#endif /* __CONNECTOR_H__ */
+/* $end connector.h */
@@ -0,0 +1,135 @@
+#include "connpool.h"
+
+static unsigned int connpool_hash(const char *key)
+{
+    unsigned int h = 5381;
+
+    while (*key)
+        h = h * 33 + (unsigned char) *key++;
+    return h % CONNPOOL_BUCKETS;
+}
+
+static time_t connpool_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* An idle connection must have nothing to read, EOF or data means the server gave up on it */
+static int connpool_alive(int fd)
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void connpool_entry_free(connpool_entry_t *e)
+{
+    Close(e->fd);
+    Free(e->key);
+    Free(e);
+}
+
+/* Create an empty pool */
+void connpool_init(connpool_t *cp)
+{
+    memset(cp->buckets, 0, sizeof(cp->buckets));
+    cp->nidle = 0;
+    Sem_init(&cp->mutex, 0, 1);
+}
+
+/* Close every pooled connection */
+void connpool_deinit(connpool_t *cp)
+{
+    connpool_entry_t *e;
+    int i;
+
+    for (i = 0; i < CONNPOOL_BUCKETS; i++) {
+        while ((e = cp->buckets[i]) != NULL) {
+            cp->buckets[i] = e->next;
+            connpool_entry_free(e);
+        }
+    }
+    cp->nidle = 0;
+}
+
+int connpool_get(connpool_t *cp, const char *key)
+{
+    connpool_entry_t **pp, *e;
+    unsigned int h = connpool_hash(key);
+    time_t now = connpool_now();
+    int fd = -1;
+
+    P(&cp->mutex);
+    pp = &cp->buckets[h];
+    while (fd < 0 && (e = *pp) != NULL) {
+        if (strcmp(e->key, key) != 0) {
+            pp = &e->next;
+            continue;
+        }
+        *pp = e->next;
+        cp->nidle--;
+        if (now - e->idle_since < CONNPOOL_IDLE_TIMEOUT && connpool_alive(e->fd)) {
+            fd = e->fd;
+            Free(e->key);
+            Free(e);
+        } else {
+            connpool_entry_free(e);
+        }
+    }
+    V(&cp->mutex);
+    return fd;
+}
+
+void connpool_put(connpool_t *cp, const char *key, int fd)
+{
+    connpool_entry_t *e;
+    unsigned int h = connpool_hash(key);
+    int n = 0;
+
+    P(&cp->mutex);
+    for (e = cp->buckets[h]; e != NULL; e = e->next) {
+        if (strcmp(e->key, key) == 0)
+            n++;
+    }
+    if (n >= CONNPOOL_MAX_IDLE) {
+        V(&cp->mutex);
+        Close(fd);
+        return;
+    }
+    e = Malloc(sizeof(connpool_entry_t));
+    e->key = Malloc(strlen(key) + 1);
+    strcpy(e->key, key);
+    e->fd = fd;
+    e->idle_since = connpool_now();
+    e->next = cp->buckets[h];
+    cp->buckets[h] = e;
+    cp->nidle++;
+    V(&cp->mutex);
+}
+
+int connpool_expire(connpool_t *cp, time_t now)
+{
+    connpool_entry_t **pp, *e;
+    int i, n = 0;
+
+    P(&cp->mutex);
+    for (i = 0; i < CONNPOOL_BUCKETS; i++) {
+        pp = &cp->buckets[i];
+        while ((e = *pp) != NULL) {
+            if (now - e->idle_since >= CONNPOOL_IDLE_TIMEOUT) {
+                *pp = e->next;
+                connpool_entry_free(e);
+                cp->nidle--;
+                n++;
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+    V(&cp->mutex);
+    return n;
+}
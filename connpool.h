@@ -0,0 +1,55 @@
+/* $begin connpool.h */
+#ifndef __CONNPOOL_H__
+#define __CONNPOOL_H__
+
+#include "csapp.h"
+
+/* Number of hash buckets, keys are "host:port" strings */
+#define CONNPOOL_BUCKETS 64
+/* Max idle connections kept per host:port */
+#define CONNPOOL_MAX_IDLE 8
+/* Seconds an idle upstream connection may wait for reuse */
+#define CONNPOOL_IDLE_TIMEOUT 30
+
+/* one idle keep-alive upstream socket */
+typedef struct connpool_entry_t {
+    char *key;
+    int fd;
+    time_t idle_since;
+    struct connpool_entry_t *next;
+} connpool_entry_t;
+
+/**
+ * thread-safe pool of idle upstream sockets keyed by host:port, shared by
+ * all workers. Pooled fds are not registered on any event loop, the taker
+ * registers them on its own loop.
+ */
+typedef struct connpool_t {
+    connpool_entry_t *buckets[CONNPOOL_BUCKETS]; /* newest entry first */
+    int nidle;                                   /* idle sockets in the pool */
+    sem_t mutex;                                 /* protects buckets and nidle */
+} connpool_t;
+
+void connpool_init(connpool_t *cp);
+void connpool_deinit(connpool_t *cp);
+
+/**
+ * take the most recently returned live connection to key
+ * @return fd or -1 when the pool holds none
+ */
+int connpool_get(connpool_t *cp, const char *key);
+
+/**
+ * hand an idle connection to key back to the pool, the fd is closed
+ * instead when key already has CONNPOOL_MAX_IDLE idle connections
+ */
+void connpool_put(connpool_t *cp, const char *key, int fd);
+
+/**
+ * close connections idle for CONNPOOL_IDLE_TIMEOUT seconds or more
+ * @return number of closed connections
+ */
+int connpool_expire(connpool_t *cp, time_t now);
+
+#endif /* __CONNPOOL_H__ */
+/* $end connpool.h */
@@ -0,0 +1,113 @@
+#include "coro.h"
+
+/* The coroutine running on this thread, makecontext can't pass a pointer portably */
+static __thread coro_t *coro_self;
+
+static size_t coro_page_size(void)
+{
+    static size_t page;
+
+    if (page == 0)
+        page = (size_t) sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+/* Entry point of every coroutine, returning lands on sched->main through uc_link */
+static void coro_entry(void)
+{
+    coro_t *co = coro_self;
+
+    co->fn(co->arg);
+    co->done = 1;
+    co->sched->current = NULL;
+}
+
+void coro_sched_init(coro_sched_t *sched)
+{
+    memset(sched, 0, sizeof(*sched));
+}
+
+void coro_sched_deinit(coro_sched_t *sched)
+{
+    coro_t *co;
+
+    while ((co = sched->pool) != NULL) {
+        sched->pool = co->next;
+        munmap(co->stack, CORO_STACK_SIZE + coro_page_size());
+        Free(co);
+    }
+    sched->npool = 0;
+}
+
+coro_t *coro_create(coro_sched_t *sched, coro_fn_t fn, void *arg)
+{
+    size_t page = coro_page_size();
+    coro_t *co;
+
+    if ((co = sched->pool) != NULL) {
+        sched->pool = co->next;
+        sched->npool--;
+    } else {
+        co = Malloc(sizeof(coro_t));
+        // pages are only backed once touched, most requests use a few KB of the stack
+        co->stack = mmap(NULL, CORO_STACK_SIZE + page, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (co->stack == MAP_FAILED)
+            unix_error("coro_create mmap error");
+        // stacks grow down, an overflow faults on the guard instead of corrupting a neighbour
+        if (mprotect(co->stack, page, PROT_NONE) < 0)
+            unix_error("coro_create mprotect error");
+    }
+    co->fn = fn;
+    co->arg = arg;
+    co->done = 0;
+    co->sched = sched;
+    co->next = NULL;
+    if (getcontext(&co->ctx) < 0)
+        unix_error("coro_create getcontext error");
+    co->ctx.uc_stack.ss_sp = (char *) co->stack + page;
+    co->ctx.uc_stack.ss_size = CORO_STACK_SIZE;
+    co->ctx.uc_link = &sched->main;
+    makecontext(&co->ctx, coro_entry, 0);
+    return co;
+}
+
+void coro_resume(coro_t *co)
+{
+    coro_sched_t *sched = co->sched;
+
+    if (sched->current != NULL)
+        app_error("coro_resume: nested resume inside a running coroutine");
+    if (co->done)
+        app_error("coro_resume: coroutine already finished");
+    sched->current = co;
+    coro_self = co;
+    if (swapcontext(&sched->main, &co->ctx) < 0)
+        unix_error("coro_resume swapcontext error");
+    sched->current = NULL;
+    coro_self = NULL;
+}
+
+void coro_yield(void)
+{
+    coro_t *co = coro_self;
+
+    if (co == NULL)
+        app_error("coro_yield: not inside a coroutine");
+    if (swapcontext(&co->ctx, &co->sched->main) < 0)
+        unix_error("coro_yield swapcontext error");
+}
+
+void coro_free(coro_t *co)
+{
+    coro_sched_t *sched = co->sched;
+
+    if (sched->npool < CORO_POOL_MAX) {
+        co->next = sched->pool;
+        sched->pool = co;
+        sched->npool++;
+        return;
+    }
+    munmap(co->stack, CORO_STACK_SIZE + coro_page_size());
+    Free(co);
+}
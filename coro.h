@@ -0,0 +1,73 @@
+/* $begin coro.h */
+#ifndef __CORO_H__
+#define __CORO_H__
+
+#include <ucontext.h>
+#include "csapp.h"
+
+/* Usable stack of one coroutine, a PROT_NONE guard page sits below it */
+#define CORO_STACK_SIZE (64 * 1024)
+
+/* Stacks a scheduler keeps mapped for reuse once their coroutine is freed */
+#define CORO_POOL_MAX 64
+
+typedef struct coro_t coro_t;
+typedef void (*coro_fn_t)(void *arg);
+
+/**
+ * a stackful coroutine: fn runs on its own mmap'ed stack and may give the
+ * thread back with coro_yield at any depth, coro_resume continues it
+ */
+struct coro_t {
+    ucontext_t ctx;
+    void *stack;                /* mapping start, guard page included */
+    coro_fn_t fn;
+    void *arg;
+    int done;                   /* fn returned, only coro_free is left */
+    struct coro_sched_t *sched;
+    struct coro_t *next;        /* free list of the scheduler */
+};
+
+/**
+ * per-thread scheduler, the event loop decides when a coroutine is resumed
+ * (usually from the callback of the fd it yielded on)
+ */
+typedef struct coro_sched_t {
+    ucontext_t main;            /* where coro_yield and a finished fn return to */
+    coro_t *current;            /* running coroutine, NULL on the thread's own stack */
+    coro_t *pool;               /* freed coroutines whose stacks are kept mapped */
+    int npool;
+} coro_sched_t;
+
+void coro_sched_init(coro_sched_t *sched);
+
+/**
+ * unmap the pooled stacks, every coroutine must have been freed
+ */
+void coro_sched_deinit(coro_sched_t *sched);
+
+/**
+ * create a coroutine running fn(arg), it does not start before coro_resume
+ */
+coro_t *coro_create(coro_sched_t *sched, coro_fn_t fn, void *arg);
+
+/**
+ * run co until it yields or returns, must be called on the thread's own stack,
+ * a nested resume or resuming a finished coroutine aborts
+ */
+void coro_resume(coro_t *co);
+
+/**
+ * give the thread back to whoever resumed the running coroutine, calling it
+ * outside a coroutine aborts
+ */
+void coro_yield(void);
+
+/**
+ * release co, a suspended coroutine is dropped without being resumed so it
+ * must not hold resources on its stack while it waits
+ */
+void coro_free(coro_t *co);
+
+#endif /* __CORO_H__ */
+/* $end coro.h */
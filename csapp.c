@@ -734,6 +734,101 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n) {
 }
 /* $end rio_writen */
 
+/*
+ * rio_writevn - Robustly write every iovec (unbuffered, one writev per try)
+ *     flags != 0 (e.g. MSG_MORE) sends with sendmsg, fd must be a socket then
+ */
+/* $begin rio_writevn */
+ssize_t rio_writevn(int fd, struct iovec *iov, int iovcnt, int flags) {
+    struct msghdr msg;
+    ssize_t nwritten, total = 0;
+
+    while (iovcnt > 0) {
+        if (flags != 0) {
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            nwritten = sendmsg(fd, &msg, flags);
+        } else {
+            nwritten = writev(fd, iov, iovcnt);
+        }
+        if (nwritten <= 0) {
+            if (errno == EINTR)  /* Interrupted by sig handler return */
+                continue;        /* and call writev() again */
+            return -1;           /* errno set by writev() */
+        }
+        total += nwritten;
+        /* Skip what went out, a partially written iovec is advanced in place */
+        while (iovcnt > 0 && (size_t) nwritten >= iov->iov_len) {
+            nwritten -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+    return total;
+}
+/* $end rio_writevn */
+
+/*
+ * rio_writeinitb - Associate a descriptor with a write buffer and reset buffer
+ */
+/* $begin rio_writeinitb */
+void rio_writeinitb(rio_w_t *wp, int fd) {
+    wp->rio_fd = fd;
+    wp->rio_cnt = 0;
+}
+/* $end rio_writeinitb */
+
+/*
+ * rio_writeb - Buffer n bytes, nothing is written until the buffer is full
+ *    or rio_flushb is called. Data that does not fit goes out together with
+ *    the buffered bytes in a single writev.
+ */
+/* $begin rio_writeb */
+ssize_t rio_writeb(rio_w_t *wp, void *usrbuf, size_t n) {
+    struct iovec iov[2];
+
+    if (wp->rio_cnt + n <= sizeof(wp->rio_buf)) {
+        memcpy(wp->rio_buf + wp->rio_cnt, usrbuf, n);
+        wp->rio_cnt += n;
+        return n;
+    }
+    iov[0].iov_base = wp->rio_buf;
+    iov[0].iov_len = wp->rio_cnt;
+    iov[1].iov_base = usrbuf;
+    iov[1].iov_len = n;
+    if (rio_writevn(wp->rio_fd, iov, 2, 0) < 0)
+        return -1;
+    wp->rio_cnt = 0;
+    return n;
+}
+/* $end rio_writeb */
+
+/*
+ * rio_flushb - Write out everything buffered. flags is passed to send(),
+ *    MSG_MORE keeps a short response in the socket until the data that
+ *    follows it is written.
+ */
+/* $begin rio_flushb */
+ssize_t rio_flushb(rio_w_t *wp, int flags) {
+    struct iovec iov;
+    ssize_t n;
+
+    if (wp->rio_cnt == 0)
+        return 0;
+    iov.iov_base = wp->rio_buf;
+    iov.iov_len = wp->rio_cnt;
+    if ((n = rio_writevn(wp->rio_fd, &iov, 1, flags)) < 0)
+        return -1;
+    wp->rio_cnt = 0;
+    return n;
+}
+/* $end rio_flushb */
+
 
 /*
  * rio_read - This is a wrapper for the Unix read() function that
@@ -804,29 +899,45 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
 
 /*
  * rio_readlineb - Robustly read a text line (buffered)
+ *     The newline is searched in the internal buffer with memchr and the
+ *     whole run up to it is copied at once instead of one rio_read per byte.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) {
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-            *bufp++ = c;
-            if (c == '\n') {
-                n++;
-                break;
+    size_t n = 0, cnt;
+    char *bufp = usrbuf, *nl;
+
+    while (n + 1 < maxlen) {
+        if (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
+            rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
+            if (rp->rio_cnt < 0) {
+                if (errno != EINTR) /* Interrupted by sig handler return */
+                    return -1;      /* Error */
+                continue;
             }
-        } else if (rc == 0) {
-            if (n == 1)
-                return 0; /* EOF, no data read */
-            else
-                break;    /* EOF, some data was read */
-        } else
-            return -1;      /* Error */
+            if (rp->rio_cnt == 0) {
+                if (n == 0)
+                    return 0;   /* EOF, no data read */
+                break;          /* EOF, some data was read */
+            }
+            rp->rio_bufptr = rp->rio_buf;
+        }
+
+        cnt = maxlen - 1 - n;
+        if (rp->rio_cnt < cnt)
+            cnt = rp->rio_cnt;
+        if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+            cnt = nl - rp->rio_bufptr + 1;
+        memcpy(bufp, rp->rio_bufptr, cnt);
+        bufp += cnt;
+        n += cnt;
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        if (nl != NULL)
+            break;
     }
     *bufp = 0;
-    return n - 1;
+    return n;
 }
 /* $end rio_readlineb */
 
@@ -846,6 +957,20 @@ void Rio_writen(int fd, void *usrbuf, size_t n) {
         unix_error("Rio_writen error");
 }
 
+void Rio_writeinitb(rio_w_t *wp, int fd) {
+    rio_writeinitb(wp, fd);
+}
+
+void Rio_writeb(rio_w_t *wp, void *usrbuf, size_t n) {
+    if (rio_writeb(wp, usrbuf, n) != n)
+        unix_error("Rio_writeb error");
+}
+
+void Rio_flushb(rio_w_t *wp) {
+    if (rio_flushb(wp, 0) < 0)
+        unix_error("Rio_flushb error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd) {
     rio_readinitb(rp, fd);
 }
@@ -1001,6 +1126,39 @@ int open_listenfd(int port) {
 }
 /* $end open_listenfd */
 
+/*
+ * open_listenfd_reuseport - Same as open_listenfd but the socket is
+ *     non-blocking and bound with SO_REUSEPORT, so every thread can own
+ *     a listening socket on the same port and the kernel spreads
+ *     incoming connections across them.
+ */
+int open_listenfd_reuseport(int port) {
+    int listenfd, optval = 1;
+    struct sockaddr_in serveraddr;
+
+    if ((listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+
+    if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+                   (const void *) &optval, sizeof(int)) < 0 ||
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                   (const void *) &optval, sizeof(int)) < 0) {
+        close(listenfd);
+        return -1;
+    }
+
+    bzero((char *) &serveraddr, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serveraddr.sin_port = htons((unsigned short) port);
+    if (bind(listenfd, (SA *) &serveraddr, sizeof(serveraddr)) < 0 ||
+        listen(listenfd, LISTENQ) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
  ****************************************************/
@@ -1020,6 +1178,14 @@ int Open_listenfd(int port) {
     return rc;
 }
 
+int Open_listenfd_reuseport(int port) {
+    int rc;
+
+    if ((rc = open_listenfd_reuseport(port)) < 0)
+        unix_error("Open_listenfd_reuseport error");
+    return rc;
+}
+
 /* $end csapp.c */
 
 /*
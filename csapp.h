@@ -25,6 +25,7 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -51,6 +52,15 @@ typedef struct {
 } rio_t;
 /* $end rio_t */
 
+/* Persistent state for buffered Rio writes */
+/* $begin rio_w_t */
+typedef struct {
+    int rio_fd;                /* Descriptor for this internal buf */
+    int rio_cnt;               /* Buffered bytes not yet written */
+    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+} rio_w_t;
+/* $end rio_w_t */
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -178,6 +188,10 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_writevn(int fd, struct iovec *iov, int iovcnt, int flags);
+void rio_writeinitb(rio_w_t *wp, int fd);
+ssize_t rio_writeb(rio_w_t *wp, void *usrbuf, size_t n);
+ssize_t rio_flushb(rio_w_t *wp, int flags);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -185,15 +199,20 @@ void Rio_writen(int fd, void *usrbuf, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+void Rio_writeinitb(rio_w_t *wp, int fd);
+void Rio_writeb(rio_w_t *wp, void *usrbuf, size_t n);
+void Rio_flushb(rio_w_t *wp);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
 int open_listenfd(int port);
+int open_listenfd_reuseport(int port);
 int Open_clientfd_r(char *hostname, int port);
 int open_clientfd_r(char *hostname, int portno);
 /* Wrappers for reentrant protocol-independent client/server helpers */
 int Open_clientfd(char *hostname, char *port);
 int Open_listenfd(int port);
+int Open_listenfd_reuseport(int port);
 
 
 #endif /* __CSAPP_H__ */
@@ -0,0 +1,258 @@
+#include <sys/eventfd.h>
+#include "dnscache.h"
+
+static unsigned int dnscache_hash(const char *host)
+{
+    unsigned int h = 5381;
+
+    while (*host)
+        h = h * 33 + (unsigned char) tolower(*host++);
+    return h % DNSCACHE_BUCKETS;
+}
+
+static time_t dnscache_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* Hand the entry to a resolver thread, caller holds dc->mutex */
+static void dnscache_enqueue(dnscache_t *dc, dns_entry_t *e)
+{
+    e->queued = 1;
+    e->job_next = NULL;
+    if (dc->job_tail != NULL)
+        dc->job_tail->job_next = e;
+    else
+        dc->job_head = e;
+    dc->job_tail = e;
+    V(&dc->jobs);
+}
+
+/* Copy the entry's answer into q, caller holds dc->mutex */
+static void dnscache_answer(dns_entry_t *e, dns_query_t *q)
+{
+    q->naddrs = e->naddrs;
+    q->error = e->error;
+    memcpy(q->addrs, e->addrs, e->naddrs * sizeof(struct sockaddr_storage));
+}
+
+/* Drop idle entries that are expired beyond use, or else the least recently used idle one */
+static void dnscache_evict(dnscache_t *dc, time_t now)
+{
+    dns_entry_t **pp, *e, **lru = NULL;
+    int i;
+
+    for (i = 0; i < DNSCACHE_BUCKETS; i++) {
+        pp = &dc->buckets[i];
+        while ((e = *pp) != NULL) {
+            if (!e->queued && now >= e->expires + DNSCACHE_STALE) {
+                *pp = e->next;
+                Free(e->host);
+                Free(e);
+                dc->nentries--;
+                continue;
+            }
+            if (!e->queued && (lru == NULL || e->last_used < (*lru)->last_used))
+                lru = pp;
+            pp = &e->next;
+        }
+    }
+    if (dc->nentries >= DNSCACHE_MAX_ENTRIES && lru != NULL) {
+        e = *lru;
+        *lru = e->next;
+        Free(e->host);
+        Free(e);
+        dc->nentries--;
+    }
+}
+
+/* Resolver thread: run getaddrinfo for queued host names and wake their waiters */
+static void *dnscache_resolver(void *vargp)
+{
+    dnscache_t *dc = (dnscache_t *) vargp;
+    struct addrinfo hints, *res, *ai;
+    dns_entry_t *e;
+    dns_query_t *q;
+    uint64_t one = 1;
+    char *host;
+    time_t now;
+    int rv;
+
+    Pthread_detach(pthread_self());
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    while (1) {
+        P(&dc->jobs);
+        P(&dc->mutex);
+        e = dc->job_head;
+        dc->job_head = e->job_next;
+        if (dc->job_head == NULL)
+            dc->job_tail = NULL;
+        // queued entries are never evicted, but the name is copied so getaddrinfo runs unlocked
+        host = Malloc(strlen(e->host) + 1);
+        strcpy(host, e->host);
+        V(&dc->mutex);
+
+        rv = getaddrinfo(host, NULL, &hints, &res);
+        fprintf(stderr, "#dnscache_resolver resolved %s: %s\n", host, rv == 0 ? "ok" : gai_strerror(rv));
+        Free(host);
+
+        P(&dc->mutex);
+        now = dnscache_now();
+        if (rv == 0) {
+            e->naddrs = 0;
+            for (ai = res; ai != NULL && e->naddrs < DNSCACHE_MAX_ADDRS; ai = ai->ai_next) {
+                if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+                    continue;
+                memset(&e->addrs[e->naddrs], 0, sizeof(struct sockaddr_storage));
+                memcpy(&e->addrs[e->naddrs++], ai->ai_addr, ai->ai_addrlen);
+            }
+            freeaddrinfo(res);
+            e->error = e->naddrs > 0 ? 0 : EAI_NONAME;
+            e->expires = now + (e->naddrs > 0 ? DNSCACHE_TTL : DNSCACHE_NEG_TTL);
+        } else if (rv == EAI_AGAIN && e->resolved && e->error == 0 && now < e->expires + DNSCACHE_STALE) {
+            // resolver hiccup on a refresh, keep serving the old answer, the next lookup tries again
+            ;
+        } else {
+            e->naddrs = 0;
+            e->error = rv;
+            e->expires = now + DNSCACHE_NEG_TTL;
+        }
+        e->resolved = 1;
+        e->queued = 0;
+        e->hits = 0;
+        while ((q = e->waiters) != NULL) {
+            e->waiters = q->next;
+            dnscache_answer(e, q);
+            q->pending = 0;
+            q->entry = NULL;
+            if (write(q->notify.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                unix_error("dnscache_resolver eventfd write error");
+        }
+        V(&dc->mutex);
+    }
+    return NULL;
+}
+
+/* A parked query was answered, run its callback on its own loop */
+static void dns_notify_handler(event_handler_t *eh, unsigned int events)
+{
+    dns_query_t *q = (dns_query_t *) eh->data;
+    uint64_t cnt;
+
+    if (eh->fd < 0)
+        return;
+    while (read(eh->fd, &cnt, sizeof(cnt)) > 0);
+    if (q->pending)
+        return;
+    event_close(q->loop, eh);
+    q->callback(q);
+}
+
+void dnscache_init(dnscache_t *dc)
+{
+    pthread_t tid;
+    int i;
+
+    memset(dc->buckets, 0, sizeof(dc->buckets));
+    dc->nentries = 0;
+    dc->job_head = dc->job_tail = NULL;
+    Sem_init(&dc->mutex, 0, 1);
+    Sem_init(&dc->jobs, 0, 0);
+    for (i = 0; i < DNSCACHE_THREADS; i++)
+        Pthread_create(&tid, NULL, dnscache_resolver, dc);
+}
+
+void dns_query_init(dns_query_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    q->notify.fd = -1;
+    q->notify.callback = dns_notify_handler;
+    q->notify.data = q;
+}
+
+int dnscache_resolve(dnscache_t *dc, dns_query_t *q, event_loop_t *loop, const char *host)
+{
+    unsigned int h = dnscache_hash(host);
+    time_t now = dnscache_now();
+    dns_entry_t *e;
+
+    q->loop = loop;
+    q->naddrs = 0;
+    q->error = 0;
+    P(&dc->mutex);
+    for (e = dc->buckets[h]; e != NULL; e = e->next) {
+        if (strcasecmp(e->host, host) == 0)
+            break;
+    }
+    if (e != NULL && e->resolved) {
+        e->last_used = now;
+        if (e->error == 0 && now < e->expires + DNSCACHE_STALE) {
+            dnscache_answer(e, q);
+            e->hits++;
+            // expired ones and hot ones close to expiry are refreshed while the old answer is served
+            if (!e->queued && (now >= e->expires
+                               || (e->expires - now <= DNSCACHE_REFRESH_AHEAD && e->hits >= DNSCACHE_HOT_HITS)))
+                dnscache_enqueue(dc, e);
+            V(&dc->mutex);
+            return 1;
+        }
+        if (e->error != 0 && now < e->expires) {
+            dnscache_answer(e, q);
+            V(&dc->mutex);
+            return 1;
+        }
+    }
+
+    if (e == NULL) {
+        if (dc->nentries >= DNSCACHE_MAX_ENTRIES)
+            dnscache_evict(dc, now);
+        e = Calloc(1, sizeof(dns_entry_t));
+        e->host = Malloc(strlen(host) + 1);
+        strcpy(e->host, host);
+        e->last_used = now;
+        e->next = dc->buckets[h];
+        dc->buckets[h] = e;
+        dc->nentries++;
+    }
+    if ((q->notify.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || event_add(loop, &q->notify, EVENT_READ) < 0) {
+        if (q->notify.fd >= 0)
+            Close(q->notify.fd);
+        q->notify.fd = -1;
+        V(&dc->mutex);
+        return -1;
+    }
+    if (!e->queued)
+        dnscache_enqueue(dc, e);
+    q->entry = e;
+    q->pending = 1;
+    q->next = e->waiters;
+    e->waiters = q;
+    V(&dc->mutex);
+    return 0;
+}
+
+void dnscache_cancel(dnscache_t *dc, dns_query_t *q)
+{
+    dns_query_t **pp;
+
+    if (q->notify.fd < 0)
+        return;
+    P(&dc->mutex);
+    if (q->pending) {
+        for (pp = &q->entry->waiters; *pp != NULL; pp = &(*pp)->next) {
+            if (*pp == q) {
+                *pp = q->next;
+                break;
+            }
+        }
+        q->pending = 0;
+        q->entry = NULL;
+    }
+    V(&dc->mutex);
+    event_close(q->loop, &q->notify);
+}
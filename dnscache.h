@@ -0,0 +1,104 @@
+/* $begin dnscache.h */
+#ifndef __DNSCACHE_H__
+#define __DNSCACHE_H__
+
+#include "csapp.h"
+#include "event.h"
+
+/* Hash buckets and max number of cached host names */
+#define DNSCACHE_BUCKETS 256
+#define DNSCACHE_MAX_ENTRIES 1024
+/* Addresses kept per host name */
+#define DNSCACHE_MAX_ADDRS 8
+/* Seconds a resolved / failed host name is trusted, getaddrinfo hides the record TTLs */
+#define DNSCACHE_TTL 60
+#define DNSCACHE_NEG_TTL 5
+/* Seconds an expired answer is still served while it is being refreshed */
+#define DNSCACHE_STALE 300
+/* Hot entries (DNSCACHE_HOT_HITS lookups since their last resolve) are refreshed
+ * DNSCACHE_REFRESH_AHEAD seconds before they expire */
+#define DNSCACHE_REFRESH_AHEAD 10
+#define DNSCACHE_HOT_HITS 2
+/* Resolver threads running getaddrinfo */
+#define DNSCACHE_THREADS 2
+
+typedef struct dns_query_t dns_query_t;
+
+/**
+ * callback invoked on the query's loop once its host name is resolved
+ * @param q the query, q->naddrs addresses in q->addrs or q->error set
+ */
+typedef void (*dns_callback_t)(dns_query_t *q);
+
+/* one cached host name */
+typedef struct dns_entry_t {
+    char *host;
+    int resolved;               /* answer (addresses or error) available */
+    int error;                  /* EAI_* of the last failed resolve, 0 if ok */
+    struct sockaddr_storage addrs[DNSCACHE_MAX_ADDRS];
+    int naddrs;
+    time_t expires;
+    time_t last_used;
+    int hits;                   /* lookups since the last resolve */
+    int queued;                 /* waiting for or inside a resolver thread */
+    dns_query_t *waiters;       /* queries parked until the resolve is done */
+    struct dns_entry_t *next;   /* bucket chain */
+    struct dns_entry_t *job_next;
+} dns_entry_t;
+
+/**
+ * a lookup from an event loop thread, usually embedded in the object that
+ * needs the addresses. Misses are parked until a resolver thread kicks the
+ * query's eventfd, the callback then runs on the query's loop.
+ */
+struct dns_query_t {
+    event_loop_t *loop;
+    event_handler_t notify;     /* eventfd written by the resolver, fd -1 when idle */
+    dns_entry_t *entry;
+    dns_query_t *next;          /* entry's waiter list */
+    int pending;
+    struct sockaddr_storage addrs[DNSCACHE_MAX_ADDRS];
+    int naddrs;
+    int error;
+    dns_callback_t callback;
+    void *data;                 /* owner of this query */
+};
+
+/**
+ * host name -> addresses cache shared by all workers, with positive and
+ * negative TTLs and background refresh of hot entries
+ */
+typedef struct dnscache_t {
+    dns_entry_t *buckets[DNSCACHE_BUCKETS];
+    int nentries;
+    dns_entry_t *job_head;      /* host names waiting for a resolver thread */
+    dns_entry_t *job_tail;
+    sem_t mutex;                /* protects everything above */
+    sem_t jobs;                 /* counts queued host names */
+} dnscache_t;
+
+/**
+ * set up an empty cache and start its resolver threads
+ */
+void dnscache_init(dnscache_t *dc);
+
+/**
+ * prepare q for dnscache_resolve, must be called once before first use
+ */
+void dns_query_init(dns_query_t *q);
+
+/**
+ * look host up without blocking
+ * @return 1 when answered from the cache (q->addrs / q->error are set, the
+ *         callback is not invoked), 0 when q->callback will run on loop later,
+ *         -1 with errno set when the query cannot be parked
+ */
+int dnscache_resolve(dnscache_t *dc, dns_query_t *q, event_loop_t *loop, const char *host);
+
+/**
+ * forget a parked query, its callback is not invoked anymore
+ */
+void dnscache_cancel(dnscache_t *dc, dns_query_t *q);
+
+#endif /* __DNSCACHE_H__ */
+/* $end dnscache.h */
@@ -0,0 +1,676 @@
+#include <sys/timerfd.h>
+#include "event.h"
+
+/* glibc only declares accept4 under _GNU_SOURCE, which clashes with csapp's gai_error */
+int accept4(int, struct sockaddr *, socklen_t *, int);
+
+/* Ring operation a completion belongs to, kept in the top bits of its user_data */
+#define URING_POLL   0ULL
+#define URING_RECV   1ULL
+#define URING_SEND   2ULL
+#define URING_ACCEPT 3ULL
+
+/* Pack operation, fd (send buffer for URING_SEND) and registration id into an io_uring user_data */
+#define URING_TAG(op, id, seq) (((op) << 62) | ((__u64) (unsigned int) (id) << 32) | (seq))
+#define URING_OP(user_data) ((user_data) >> 62)
+#define URING_ID(user_data) ((int) (((user_data) >> 32) & 0x3fffffff))
+
+/* Buffer group of the provided buffer ring */
+#define URING_BGID 0
+
+/* event_handler_t io bits */
+#define EVENT_IO           0x01    /* registered with event_add_io */
+#define EVENT_IO_RECV      0x02    /* a recv is queued */
+#define EVENT_IO_ACCEPT    0x04    /* the multishot accept is armed */
+#define EVENT_IO_EOF       0x08    /* peer closed, event_recv returns 0 from now on */
+#define EVENT_IO_WAIT_RECV 0x10    /* on loop->waiting, no provided buffer was left */
+
+/* Address of recv buffer bid */
+static char *uring_recv_buf(event_loop_t *loop, int bid)
+{
+    return loop->recv_bufs[bid / EVENT_URING_RECV_BUFS] + (size_t) (bid % EVENT_URING_RECV_BUFS) * EVENT_URING_BUF_SIZE;
+}
+
+/* Give recv buffer bid back to the kernel */
+static void uring_recycle(event_loop_t *loop, int bid)
+{
+    struct io_uring_buf *b = &loop->br->bufs[loop->br_tail & (EVENT_URING_RECV_RING - 1)];
+
+    b->addr = (unsigned long) uring_recv_buf(loop, bid);
+    b->len = EVENT_URING_BUF_SIZE;
+    b->bid = bid;
+    __atomic_store_n(&loop->br->tail, ++loop->br_tail, __ATOMIC_RELEASE);
+    loop->freed = 1;
+}
+
+/**
+ * hand EVENT_URING_RECV_BUFS more recv buffers to the kernel, handlers that
+ * don't take their bytes out must not starve the others
+ * @return 0, -1 once the ring is full
+ */
+static int uring_recv_grow(event_loop_t *loop)
+{
+    int i, block = loop->nrecv / EVENT_URING_RECV_BUFS;
+
+    if (loop->nrecv == EVENT_URING_RECV_RING)
+        return -1;
+    loop->recv_bufs = Realloc(loop->recv_bufs, (block + 1) * sizeof(char *));
+    loop->recv_bufs[block] = Malloc((size_t) EVENT_URING_RECV_BUFS * EVENT_URING_BUF_SIZE);
+    for (i = 0; i < EVENT_URING_RECV_BUFS; i++)
+        uring_recycle(loop, loop->nrecv + i);
+    loop->nrecv += EVENT_URING_RECV_BUFS;
+    return 0;
+}
+
+/**
+ * add EVENT_URING_SEND_BUFS send buffers to the free list. A send may wait
+ * for its peer forever, so there is no limit: every handler holds one at most
+ */
+static void uring_send_grow(event_loop_t *loop)
+{
+    char *block = Malloc((size_t) EVENT_URING_SEND_BUFS * EVENT_URING_BUF_SIZE);
+    int i, n = loop->nsends;
+
+    /* in flight sends are found by index, their data does not move */
+    loop->sends = Realloc(loop->sends, (n + EVENT_URING_SEND_BUFS) * sizeof(event_sendbuf_t));
+    for (i = 0; i < EVENT_URING_SEND_BUFS; i++) {
+        loop->sends[n + i].data = block + (size_t) i * EVENT_URING_BUF_SIZE;
+        loop->sends[n + i].owner = NULL;
+        loop->sends[n + i].next_free = i + 1 < EVENT_URING_SEND_BUFS ? n + i + 1 : loop->send_free;
+    }
+    loop->send_free = n;
+    loop->nsends = n + EVENT_URING_SEND_BUFS;
+}
+
+/* Register the provided buffer ring and set up the first recv and send buffers */
+static int uring_buffers_init(event_loop_t *loop)
+{
+    struct io_uring_buf_reg reg;
+
+    loop->br = mmap(NULL, EVENT_URING_RECV_RING * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (loop->br == MAP_FAILED)
+        return -1;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) loop->br;
+    reg.ring_entries = EVENT_URING_RECV_RING;
+    reg.bgid = URING_BGID;
+    if (uring_register(&loop->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(loop->br, EVENT_URING_RECV_RING * sizeof(struct io_uring_buf));
+        return -1;
+    }
+    uring_recv_grow(loop);
+    loop->send_free = -1;
+    uring_send_grow(loop);
+    loop->freed = 0;
+    return 0;
+}
+
+/* Create an empty event loop on the requested backend */
+void event_loop_init(event_loop_t *loop, int backend)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->epfd = -1;
+    loop->backend = EVENT_BACKEND_EPOLL;
+    if (backend == EVENT_BACKEND_URING) {
+        /* SINGLE_ISSUER only promises that this thread alone submits. As a linux 6.0 flag it also
+         * turns away kernels without multishot accept and provided buffer rings, those fall back */
+        if (uring_init(&loop->ring, EVENT_URING_ENTRIES,
+                       IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN) == 0) {
+            if (uring_buffers_init(loop) == 0) {
+                loop->backend = EVENT_BACKEND_URING;
+                return;
+            }
+            uring_deinit(&loop->ring);
+        }
+        fprintf(stderr, "#event_loop_init io_uring unavailable (%s), fall back to epoll\n", strerror(errno));
+    }
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("event_loop_init epoll_create1 error");
+}
+
+/* Clean up loop, registered fds are owned by their handlers */
+void event_loop_deinit(event_loop_t *loop)
+{
+    int i;
+
+    if (loop->backend == EVENT_BACKEND_URING) {
+        /* the kernel lets go of the buffers together with the ring */
+        uring_deinit(&loop->ring);
+        munmap(loop->br, EVENT_URING_RECV_RING * sizeof(struct io_uring_buf));
+        for (i = 0; i < loop->nrecv / EVENT_URING_RECV_BUFS; i++)
+            Free(loop->recv_bufs[i]);
+        Free(loop->recv_bufs);
+        for (i = 0; i < loop->nsends; i += EVENT_URING_SEND_BUFS)
+            Free(loop->sends[i].data);
+        Free(loop->sends);
+        Free(loop->handlers);
+    } else {
+        Close(loop->epfd);
+    }
+}
+
+/* Queue a multishot poll for eh, it is sent with the next io_uring_enter */
+static void uring_arm(event_loop_t *loop, event_handler_t *eh)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = eh->fd;
+    /* without IORING_POLL_ADD_LEVEL the kernel reports edges only, EPOLLET just says so */
+    sqe->poll32_events = eh->events | EPOLLET;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_TAG(URING_POLL, eh->fd, eh->seq);
+}
+
+/* Queue a recv of up to n bytes into a buffer the kernel picks from the provided buffer ring */
+static void uring_recv(event_loop_t *loop, event_handler_t *eh, size_t n)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = eh->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->len = n < EVENT_URING_BUF_SIZE ? n : EVENT_URING_BUF_SIZE;
+    sqe->user_data = URING_TAG(URING_RECV, eh->fd, eh->seq);
+    eh->io |= EVENT_IO_RECV;
+}
+
+/* Queue the rest of send buffer i, the kernel waits for room in the socket itself */
+static void uring_send(event_loop_t *loop, int i, unsigned int seq)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    event_sendbuf_t *sb = &loop->sends[i];
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sb->owner->fd;
+    sqe->addr = (unsigned long) (sb->data + sb->off);
+    sqe->len = sb->len - sb->off;
+    sqe->msg_flags = sb->flags | MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = URING_TAG(URING_SEND, i, seq);
+}
+
+/* Queue a cancel of the request tagged user_data, its completion comes back with -ECANCELED */
+static void uring_cancel(event_loop_t *loop, __u64 user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = 0;
+}
+
+/* Find the live handler a completion belongs to, NULL for stale ones */
+static event_handler_t *uring_lookup(event_loop_t *loop, __u64 user_data)
+{
+    int fd = URING_ID(user_data);
+    event_handler_t *eh;
+
+    if (fd >= loop->nhandlers || (eh = loop->handlers[fd]) == NULL)
+        return NULL;
+    return eh->seq == (unsigned int) user_data ? eh : NULL;
+}
+
+/* Put eh in the fd -> handler table under a new registration id */
+static void uring_register_handler(event_loop_t *loop, event_handler_t *eh)
+{
+    if (eh->fd >= loop->nhandlers) {
+        int n = loop->nhandlers ? loop->nhandlers : 64;
+        while (n <= eh->fd)
+            n *= 2;
+        loop->handlers = Realloc(loop->handlers, n * sizeof(event_handler_t *));
+        memset(loop->handlers + loop->nhandlers, 0, (n - loop->nhandlers) * sizeof(event_handler_t *));
+        loop->nhandlers = n;
+    }
+    /* seq 0 is never handed out so user_data 0 marks our own cancel requests */
+    if (++loop->next_seq == 0)
+        ++loop->next_seq;
+    eh->seq = loop->next_seq;
+    loop->handlers[eh->fd] = eh;
+}
+
+/* every recv buffer is taken and the ring can't grow, eh gets another go once one came back */
+static void uring_wait(event_loop_t *loop, event_handler_t *eh, unsigned int bit)
+{
+    eh->io |= bit;
+    eh->next_wait = NULL;
+    if (loop->waiting_tail != NULL)
+        loop->waiting_tail->next_wait = eh;
+    else
+        loop->waiting = eh;
+    loop->waiting_tail = eh;
+}
+
+/* Take eh off loop->waiting */
+static void uring_unwait(event_loop_t *loop, event_handler_t *eh)
+{
+    event_handler_t **p, *prev = NULL;
+
+    for (p = &loop->waiting; *p != NULL; prev = *p, p = &(*p)->next_wait) {
+        if (*p == eh) {
+            *p = eh->next_wait;
+            if (loop->waiting_tail == eh)
+                loop->waiting_tail = prev;
+            break;
+        }
+    }
+    eh->io &= ~EVENT_IO_WAIT_RECV;
+}
+
+/* recv buffers came back during this iteration: requeue the recvs that found the provided buffer ring empty */
+static void uring_wake(event_loop_t *loop)
+{
+    event_handler_t *eh;
+    int n = 0;
+
+    if (!loop->freed)
+        return;
+    loop->freed = 0;
+    for (eh = loop->waiting; eh != NULL; eh = eh->next_wait)
+        n++;
+    /* handlers still short go to the back, the ones there before them are not looked at twice */
+    while (n-- > 0 && (eh = loop->waiting) != NULL) {
+        uring_unwait(loop, eh);
+        uring_recv(loop, eh, EVENT_URING_BUF_SIZE);
+    }
+}
+
+int event_add(event_loop_t *loop, event_handler_t *eh, unsigned int events)
+{
+    struct epoll_event ev;
+
+    eh->events = events;
+    eh->io = 0;
+    if (loop->backend == EVENT_BACKEND_URING) {
+        uring_register_handler(loop, eh);
+        uring_arm(loop, eh);
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLET;
+    ev.data.ptr = eh;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, eh->fd, &ev);
+}
+
+int event_add_io(event_loop_t *loop, event_handler_t *eh)
+{
+    if (loop->backend != EVENT_BACKEND_URING)
+        return event_add(loop, eh, EVENT_READ | EVENT_WRITE);
+    /* nothing is queued before the first call asks for it */
+    eh->events = EVENT_READ | EVENT_WRITE;
+    eh->io = EVENT_IO;
+    eh->rbuf = eh->sbuf = eh->accepted = -1;
+    eh->roff = eh->rlen = 0;
+    eh->error = 0;
+    uring_register_handler(loop, eh);
+    return 0;
+}
+
+ssize_t event_recv(event_loop_t *loop, event_handler_t *eh, void *buf, size_t n)
+{
+    size_t m;
+
+    if (!(eh->io & EVENT_IO))
+        return read(eh->fd, buf, n);
+    if (eh->rbuf >= 0) {
+        m = eh->rlen - eh->roff < n ? eh->rlen - eh->roff : n;
+        memcpy(buf, uring_recv_buf(loop, eh->rbuf) + eh->roff, m);
+        eh->roff += m;
+        if (eh->roff == eh->rlen) {
+            uring_recycle(loop, eh->rbuf);
+            eh->rbuf = -1;
+        }
+        return m;
+    }
+    if (eh->error != 0) {
+        errno = eh->error;
+        return -1;
+    }
+    if (eh->io & EVENT_IO_EOF)
+        return 0;
+    if (!(eh->io & (EVENT_IO_RECV | EVENT_IO_WAIT_RECV)))
+        uring_recv(loop, eh, n);
+    errno = EAGAIN;
+    return -1;
+}
+
+size_t event_recv_pending(event_handler_t *eh)
+{
+    return (eh->io & EVENT_IO) && eh->rbuf >= 0 ? eh->rlen - eh->roff : 0;
+}
+
+ssize_t event_send(event_loop_t *loop, event_handler_t *eh, const void *buf, size_t n, int flags)
+{
+    event_sendbuf_t *sb;
+    int i;
+
+    if (!(eh->io & EVENT_IO))
+        return send(eh->fd, buf, n, flags);
+    if (eh->error != 0) {
+        errno = eh->error;
+        return -1;
+    }
+    if (eh->sbuf >= 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (loop->send_free < 0)
+        uring_send_grow(loop);
+    i = loop->send_free;
+    loop->send_free = loop->sends[i].next_free;
+    sb = &loop->sends[i];
+    sb->owner = eh;
+    sb->off = 0;
+    sb->len = n < EVENT_URING_BUF_SIZE ? n : EVENT_URING_BUF_SIZE;
+    sb->flags = flags;
+    memcpy(sb->data, buf, sb->len);
+    eh->sbuf = i;
+    uring_send(loop, i, eh->seq);
+    return sb->len;
+}
+
+int event_sent(event_loop_t *loop, event_handler_t *eh)
+{
+    if (!(eh->io & EVENT_IO))
+        return 1;
+    if (eh->error != 0) {
+        errno = eh->error;
+        return -1;
+    }
+    return eh->sbuf < 0;
+}
+
+int event_accept(event_loop_t *loop, event_handler_t *eh)
+{
+    struct io_uring_sqe *sqe;
+    int fd;
+
+    if (!(eh->io & EVENT_IO))
+        return accept4(eh->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if ((fd = eh->accepted) >= 0) {
+        eh->accepted = -1;
+        return fd;
+    }
+    if (eh->error != 0) {
+        /* the listener goes on, only this accept failed */
+        errno = eh->error;
+        eh->error = 0;
+        return -1;
+    }
+    if (!(eh->io & EVENT_IO_ACCEPT)) {
+        sqe = uring_get_sqe(&loop->ring);
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = eh->fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = URING_TAG(URING_ACCEPT, eh->fd, eh->seq);
+        eh->io |= EVENT_IO_ACCEPT;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+int event_del(event_loop_t *loop, event_handler_t *eh)
+{
+    struct epoll_event ev;
+
+    eh->events = 0;
+    if (loop->backend == EVENT_BACKEND_URING) {
+        if (eh->fd < 0 || eh->fd >= loop->nhandlers || loop->handlers[eh->fd] != eh)
+            return -1;
+        loop->handlers[eh->fd] = NULL;
+        if (!(eh->io & EVENT_IO)) {
+            uring_cancel(loop, URING_TAG(URING_POLL, eh->fd, eh->seq));
+            return 0;
+        }
+        if (eh->io & EVENT_IO_RECV)
+            uring_cancel(loop, URING_TAG(URING_RECV, eh->fd, eh->seq));
+        if (eh->io & EVENT_IO_ACCEPT)
+            uring_cancel(loop, URING_TAG(URING_ACCEPT, eh->fd, eh->seq));
+        if (eh->sbuf >= 0) {
+            /* the buffer stays taken until the cancelled send completed */
+            loop->sends[eh->sbuf].owner = NULL;
+            uring_cancel(loop, URING_TAG(URING_SEND, eh->sbuf, eh->seq));
+        }
+        if (eh->rbuf >= 0)
+            uring_recycle(loop, eh->rbuf);
+        if (eh->accepted >= 0)
+            close(eh->accepted);
+        if (eh->io & EVENT_IO_WAIT_RECV)
+            uring_unwait(loop, eh);
+        eh->io = 0;
+        eh->rbuf = eh->sbuf = eh->accepted = -1;
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, eh->fd, &ev);
+}
+
+void event_close(event_loop_t *loop, event_handler_t *eh)
+{
+    /* epoll drops a closed fd from its set by itself */
+    if (loop->backend == EVENT_BACKEND_URING)
+        event_del(loop, eh);
+    Close(eh->fd);
+    eh->fd = -1;
+}
+
+int event_add_timer(event_loop_t *loop, event_handler_t *eh, int interval_ms)
+{
+    struct itimerspec its;
+
+    if ((eh->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        return -1;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(eh->fd, 0, &its, NULL) < 0) {
+        close(eh->fd);
+        eh->fd = -1;
+        return -1;
+    }
+    return event_add(loop, eh, EVENT_READ);
+}
+
+void event_defer(event_loop_t *loop, void (*fn)(void *), void *arg)
+{
+    event_deferred_t *d = Malloc(sizeof(event_deferred_t));
+
+    d->fn = fn;
+    d->arg = arg;
+    d->next = loop->deferred;
+    loop->deferred = d;
+}
+
+/* Run and release everything queued by event_defer */
+static void run_deferred(event_loop_t *loop)
+{
+    event_deferred_t *d;
+
+    while ((d = loop->deferred) != NULL) {
+        loop->deferred = d->next;
+        d->fn(d->arg);
+        Free(d);
+    }
+}
+
+static void epoll_loop_run(event_loop_t *loop)
+{
+    struct epoll_event evs[EVENT_BATCH_SIZE];
+    int i, n;
+
+    while (!loop->stopped) {
+        if ((n = epoll_wait(loop->epfd, evs, EVENT_BATCH_SIZE, -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("event_loop_run epoll_wait error");
+        }
+        for (i = 0; i < n; i++) {
+            event_handler_t *eh = evs[i].data.ptr;
+            eh->callback(eh, evs[i].events);
+        }
+        run_deferred(loop);
+    }
+}
+
+/* A send completed: queue what the kernel did not take yet or give the buffer back */
+static void uring_send_done(event_loop_t *loop, __u64 user_data, int res)
+{
+    int i = URING_ID(user_data);
+    event_sendbuf_t *sb = &loop->sends[i];
+    event_handler_t *eh = sb->owner;
+
+    if (eh != NULL && res > 0 && sb->off + res < sb->len) {
+        sb->off += res;
+        uring_send(loop, i, eh->seq);
+        return;
+    }
+    sb->owner = NULL;
+    sb->next_free = loop->send_free;
+    loop->send_free = i;
+    if (eh == NULL)
+        return;     /* owner unregistered, the send was cancelled or went out for nobody */
+    eh->sbuf = -1;
+    if (res < 0)
+        eh->error = -res;
+    eh->callback(eh, res < 0 ? EPOLLOUT | EPOLLERR : EPOLLOUT);
+}
+
+/* A recv completed, its bytes wait in the picked buffer for event_recv */
+static void uring_recv_done(event_loop_t *loop, __u64 user_data, int res, unsigned int flags)
+{
+    int bid = flags & IORING_CQE_F_BUFFER ? (int) (flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    event_handler_t *eh;
+
+    if ((eh = uring_lookup(loop, user_data)) == NULL) {
+        if (bid >= 0)
+            uring_recycle(loop, bid);
+        return;
+    }
+    eh->io &= ~EVENT_IO_RECV;
+    if (res > 0 && bid >= 0) {
+        eh->rbuf = bid;
+        eh->roff = 0;
+        eh->rlen = res;
+        eh->callback(eh, EPOLLIN);
+        return;
+    }
+    if (bid >= 0)
+        uring_recycle(loop, bid);
+    if (res == -ENOBUFS) {
+        /* every provided buffer holds bytes not taken yet, add some or wait once the ring is full */
+        if (uring_recv_grow(loop) == 0)
+            uring_recv(loop, eh, EVENT_URING_BUF_SIZE);
+        else
+            uring_wait(loop, eh, EVENT_IO_WAIT_RECV);
+        return;
+    }
+    if (res == 0) {
+        eh->io |= EVENT_IO_EOF;
+        eh->callback(eh, EPOLLIN | EPOLLRDHUP);
+        return;
+    }
+    eh->error = res < 0 ? -res : EIO;
+    eh->callback(eh, EPOLLIN | EPOLLERR);
+}
+
+/* The multishot accept produced a connection or failed */
+static void uring_accept_done(event_loop_t *loop, __u64 user_data, int res, unsigned int flags)
+{
+    event_handler_t *eh;
+
+    if ((eh = uring_lookup(loop, user_data)) == NULL) {
+        if (res >= 0)
+            close(res);
+        return;
+    }
+    /* the kernel ended the multishot, the next event_accept arms a new one */
+    if (!(flags & IORING_CQE_F_MORE))
+        eh->io &= ~EVENT_IO_ACCEPT;
+    if (res >= 0) {
+        if (eh->accepted >= 0)
+            close(eh->accepted);
+        eh->accepted = res;
+        eh->callback(eh, EPOLLIN);
+        return;
+    }
+    eh->error = -res;
+    eh->callback(eh, EPOLLIN | EPOLLERR);
+}
+
+static void uring_loop_run(event_loop_t *loop)
+{
+    struct io_uring_cqe *cqe;
+    event_handler_t *eh;
+    __u64 user_data;
+    unsigned int flags;
+    int i, res;
+
+    while (!loop->stopped) {
+        /* one syscall submits this round's ring requests and waits */
+        if (uring_submit_and_wait(&loop->ring, 1) < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            unix_error("event_loop_run io_uring_enter error");
+        }
+        for (i = 0; i < EVENT_BATCH_SIZE && (cqe = uring_peek_cqe(&loop->ring)) != NULL; i++) {
+            user_data = cqe->user_data;
+            res = cqe->res;
+            flags = cqe->flags;
+            uring_cqe_seen(&loop->ring);
+
+            if (user_data == 0)
+                continue;   /* cancel completion */
+            switch (URING_OP(user_data)) {
+                case URING_RECV:
+                    uring_recv_done(loop, user_data, res, flags);
+                    continue;
+                case URING_SEND:
+                    uring_send_done(loop, user_data, res);
+                    continue;
+                case URING_ACCEPT:
+                    uring_accept_done(loop, user_data, res, flags);
+                    continue;
+            }
+            if ((eh = uring_lookup(loop, user_data)) == NULL)
+                continue;   /* handler already gone */
+            if (res < 0) {
+                /* poll could not be armed, report it like epoll would */
+                loop->handlers[eh->fd] = NULL;
+                eh->callback(eh, EPOLLERR);
+                continue;
+            }
+            if (!(flags & IORING_CQE_F_MORE))
+                uring_arm(loop, eh);    /* kernel ended the multishot, re-arm */
+            eh->callback(eh, (unsigned int) res);
+        }
+        uring_wake(loop);
+        run_deferred(loop);
+    }
+}
+
+void event_loop_run(event_loop_t *loop)
+{
+    if (loop->backend == EVENT_BACKEND_URING)
+        uring_loop_run(loop);
+    else
+        epoll_loop_run(loop);
+}
+
+void event_loop_stop(event_loop_t *loop)
+{
+    loop->stopped = 1;
+}
+
+int event_nonblock(int fd)
+{
+    int flags;
+
+    if ((flags = fcntl(fd, F_GETFL, 0)) < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
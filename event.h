@@ -0,0 +1,213 @@
+/* $begin event.h */
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <sys/epoll.h>
+#include "csapp.h"
+#include "uring.h"
+
+/* Max number of ready events handled per event_loop_run iteration */
+#define EVENT_BATCH_SIZE 256
+
+/* Readiness backends an event loop can run on */
+#define EVENT_BACKEND_EPOLL 0
+#define EVENT_BACKEND_URING 1
+
+/* Submission ring size of the io_uring backend */
+#define EVENT_URING_ENTRIES 1024
+
+/* Buffers of the io_uring backend's ring I/O, see event_add_io */
+#define EVENT_URING_BUF_SIZE 65536
+#define EVENT_URING_RECV_BUFS 32    /* recv buffers added at a time */
+#define EVENT_URING_RECV_RING 1024  /* provided buffer ring entries, the most recv buffers, a power of two */
+#define EVENT_URING_SEND_BUFS 32    /* send buffers added at a time */
+
+/* Interest bits, passed straight through to epoll */
+#define EVENT_READ  (EPOLLIN | EPOLLRDHUP)
+#define EVENT_WRITE EPOLLOUT
+
+typedef struct event_handler_t event_handler_t;
+
+/**
+ * callback invoked by the loop every time the handler's fd changes readiness,
+ * for event_add_io handlers on io_uring every time one of their ring
+ * operations completed
+ * @param eh the registered handler
+ * @param events ready bits reported by epoll (EPOLLIN, EPOLLOUT, EPOLLERR ...)
+ */
+typedef void (*event_callback_t)(event_handler_t *eh, unsigned int events);
+
+/**
+ * one registration in an event loop, usually embedded inside the object
+ * (connection, listener ...) that owns the fd so no extra allocation is needed
+ */
+struct event_handler_t {
+    int fd;
+    unsigned int events;        /* interest registered for fd */
+    unsigned int seq;           /* registration id, tags io_uring completions */
+    event_callback_t callback;
+    void *data;                 /* owner of this handler */
+    /* io_uring ring I/O state of event_add_io handlers, untouched on epoll */
+    unsigned int io;            /* EVENT_IO_* bits, see event.c */
+    int rbuf;                   /* provided buffer holding received bytes not taken yet, -1 for none */
+    unsigned int roff, rlen;    /* taken and received bytes of rbuf */
+    int sbuf;                   /* send buffer in flight, -1 for none */
+    int accepted;               /* fd from the multishot accept not taken yet, -1 for none */
+    int error;                  /* errno of a failed ring operation, reported by the next call */
+    event_handler_t *next_wait; /* loop->waiting: out of recv buffers */
+};
+
+/* work queued with event_defer, executed once the current batch is done */
+typedef struct event_deferred_t {
+    void (*fn)(void *);
+    void *arg;
+    struct event_deferred_t *next;
+} event_deferred_t;
+
+/* io_uring send buffer, one per event_send in flight */
+typedef struct event_sendbuf_t {
+    char *data;                 /* EVENT_URING_BUF_SIZE bytes */
+    event_handler_t *owner;     /* NULL once the owner was unregistered */
+    unsigned int off, len;      /* sent and queued bytes */
+    int flags;                  /* send(2) flags of event_send, used again for the rest */
+    int next_free;
+} event_sendbuf_t;
+
+/**
+ * per-thread edge-triggered event loop. Every handler is registered once
+ * with EPOLLET so callbacks must drain their fd until EAGAIN.
+ * With the io_uring backend each event_add registration is a multishot
+ * poll request, edge triggered like the epoll ones. Handlers registered
+ * with event_add_io do their I/O as ring operations instead of polling:
+ * recv into a provided buffer ring, send from loop owned buffers and
+ * multishot accept. All ring requests of an iteration go to the kernel
+ * together with the wait in a single io_uring_enter.
+ */
+typedef struct event_loop_t {
+    int backend;                /* EVENT_BACKEND_EPOLL or EVENT_BACKEND_URING */
+    int epfd;
+    uring_t ring;
+    event_handler_t **handlers; /* io_uring only: fd -> live handler */
+    int nhandlers;
+    unsigned int next_seq;
+    event_deferred_t *deferred;
+    int stopped;                /* set by event_loop_stop, event_loop_run returns */
+    /* io_uring only: buffers of the ring I/O */
+    struct io_uring_buf_ring *br;   /* provided buffer ring the kernel picks recv buffers from */
+    unsigned short br_tail;
+    char **recv_bufs;           /* blocks of EVENT_URING_RECV_BUFS buffers, bid / EVENT_URING_RECV_BUFS picks one */
+    int nrecv;                  /* recv buffers handed to the kernel so far */
+    event_sendbuf_t *sends;
+    int nsends;
+    int send_free;              /* first free send buffer, -1 for none */
+    int freed;                  /* a recv buffer came back this iteration, waiting handlers get another go */
+    event_handler_t *waiting;   /* handlers out of recv buffers, in the order they ran out */
+    event_handler_t *waiting_tail;
+} event_loop_t;
+
+/**
+ * create a loop on the requested backend, falls back to epoll when the
+ * kernel cannot provide io_uring (loop->backend tells which one is used).
+ * Must be called by the thread that is going to run the loop.
+ */
+void event_loop_init(event_loop_t *loop, int backend);
+void event_loop_deinit(event_loop_t *loop);
+
+/**
+ * register eh->fd in the loop with the given interest (edge triggered)
+ * @return 0 on success, -1 with errno set on failure
+ */
+int event_add(event_loop_t *loop, event_handler_t *eh, unsigned int events);
+
+/**
+ * register eh->fd for I/O through event_recv, event_send and event_accept.
+ * On epoll this is event_add with EVENT_READ | EVENT_WRITE and the calls are
+ * plain syscalls. On io_uring they queue ring operations: the callback runs
+ * once per completion and the next call hands over its result, a call that
+ * returns EAGAIN has queued the operation it waits for.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int event_add_io(event_loop_t *loop, event_handler_t *eh);
+
+/**
+ * read(2) on an event_add_io handler
+ * @return bytes received, 0 on EOF, -1 with errno set (EAGAIN: the callback
+ *         runs once data is there)
+ */
+ssize_t event_recv(event_loop_t *loop, event_handler_t *eh, void *buf, size_t n);
+
+/**
+ * bytes an io_uring recv took from eh->fd that event_recv did not hand out
+ * yet, 0 on epoll where they are still in the socket
+ */
+size_t event_recv_pending(event_handler_t *eh);
+
+/**
+ * send(2) on an event_add_io handler. On io_uring up to EVENT_URING_BUF_SIZE
+ * bytes are copied to a send buffer and go out in the background, one send
+ * per handler at a time. The loop adds buffers when all are in flight, so a
+ * peer that stops reading only ever holds its own.
+ * @return bytes taken, -1 with errno set (EAGAIN: the callback runs once the
+ *         handler can send again)
+ */
+ssize_t event_send(event_loop_t *loop, event_handler_t *eh, const void *buf, size_t n, int flags);
+
+/**
+ * whether every byte taken by event_send reached the socket, only then may
+ * the fd be closed without cutting the data short
+ * @return 1 when it did, 0 while a send is in flight, -1 with errno set when
+ *         one failed
+ */
+int event_sent(event_loop_t *loop, event_handler_t *eh);
+
+/**
+ * accept4(2) with SOCK_NONBLOCK | SOCK_CLOEXEC on an event_add_io listener
+ * @return the new connection's fd, -1 with errno set (EAGAIN: the callback
+ *         runs once a connection came in)
+ */
+int event_accept(event_loop_t *loop, event_handler_t *eh);
+
+/**
+ * remove eh->fd from the loop, must be called before the fd is closed.
+ * Ring operations of eh still queued are cancelled.
+ */
+int event_del(event_loop_t *loop, event_handler_t *eh);
+
+/**
+ * unregister eh->fd and close it. io_uring requests hold a reference on the
+ * file, so a registered fd must never be closed directly.
+ */
+void event_close(event_loop_t *loop, event_handler_t *eh);
+
+/**
+ * register a periodic timer firing every interval_ms, eh->fd is set to a
+ * timerfd, the callback must read the 8 byte expiration count from it
+ * @return 0 on success, -1 with errno set on failure
+ */
+int event_add_timer(event_loop_t *loop, event_handler_t *eh, int interval_ms);
+
+/**
+ * run fn(arg) after all callbacks of the current batch have returned,
+ * used to release objects whose handlers may still appear in the batch
+ */
+void event_defer(event_loop_t *loop, void (*fn)(void *), void *arg);
+
+/**
+ * dispatch ready handlers until event_loop_stop is called
+ */
+void event_loop_run(event_loop_t *loop);
+
+/**
+ * make event_loop_run return once the current batch is done, must be
+ * called from one of the loop's own callbacks
+ */
+void event_loop_stop(event_loop_t *loop);
+
+/**
+ * put fd into non-blocking mode
+ * @return 0 on success, -1 with errno set on failure
+ */
+int event_nonblock(int fd);
+
+#endif /* __EVENT_H__ */
+/* $end event.h */
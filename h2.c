@@ -0,0 +1,1207 @@
+#include <ctype.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "hdrtab.h"
+#include "h2.h"
+
+/* Frame types (RFC 9113 6) */
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+/* Frame flags */
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+/* Error codes */
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED 0x5
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+/* Settings we look at */
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+/* Largest flow control window and frame size a peer may ask for */
+#define H2_WINDOW_MAX 0x7fffffff
+#define H2_FRAME_LIMIT 16777215
+
+/* Longest SETTINGS payload taken from an HTTP2-Settings header */
+#define H2_UPGRADE_SETTINGS_MAX 256
+
+/* pseudo headers and cookies of a request header block while it is decoded, from the session arena */
+typedef struct h2_request_t {
+    h2_session_t *session;
+    char *method;
+    char *authority;
+    char *path;
+    char *cookie;
+    size_t cookie_len;
+    int body;                   /* DATA frames follow, the request goes on with chunks */
+    int fields_seen;            /* a regular field came, no more pseudo headers */
+    int bad;                    /* malformed, the stream is reset */
+} h2_request_t;
+
+static void stream_pump(h2_stream_t *st);
+static void session_run(h2_session_t *s);
+
+static time_t h2_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+int h2_is_preface(const char *buf, size_t len)
+{
+    return len >= 4 && memcmp(buf, H2_PREFACE, len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN) == 0;
+}
+
+/* queue a frame header for a payload of len bytes, the caller fills in the payload */
+static uint8_t *session_frame(h2_session_t *s, int type, int flags, uint32_t id, size_t len)
+{
+    uint8_t *p;
+
+    if (s->out_len + H2_FRAME_HEADER + len > s->out_cap) {
+        // what is written already makes room before the buffer grows
+        memmove(s->outbuf, s->outbuf + s->out_off, s->out_len - s->out_off);
+        s->out_len -= s->out_off;
+        s->out_off = 0;
+        if (s->out_len + H2_FRAME_HEADER + len > s->out_cap)
+            s->outbuf = bufpool_grow(s->bufs, s->outbuf, s->out_len, &s->out_cap,
+                                     s->out_len + H2_FRAME_HEADER + len);
+    }
+    p = (uint8_t *) s->outbuf + s->out_len;
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    put32(p + 5, id);
+    s->out_len += H2_FRAME_HEADER + len;
+    return p + H2_FRAME_HEADER;
+}
+
+static void session_rst_stream(h2_session_t *s, uint32_t id, uint32_t code)
+{
+    put32(session_frame(s, H2_RST_STREAM, 0, id, 4), code);
+}
+
+static void session_window_update(h2_session_t *s, uint32_t id, uint32_t n)
+{
+    put32(session_frame(s, H2_WINDOW_UPDATE, 0, id, 4), n);
+}
+
+static void session_goaway(h2_session_t *s, uint32_t code)
+{
+    uint8_t *p = session_frame(s, H2_GOAWAY, 0, 0, 8);
+
+    put32(p, s->last_stream);
+    put32(p + 4, code);
+}
+
+/**
+ * write the session outbuf to the client
+ * @return 1 when it is drained, 0 when the client would block, -1 when
+ *         the session was closed
+ */
+static int session_flush(h2_session_t *s)
+{
+    ssize_t n;
+
+    while (s->out_off < s->out_len) {
+        if ((n = write(s->client.fd, s->outbuf + s->out_off, s->out_len - s->out_off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            fprintf(stderr, "#session_flush write to client fd %d failed: %s\n", s->client.fd, strerror(errno));
+            h2_session_close(s);
+            return -1;
+        }
+        s->out_off += n;
+    }
+    s->out_off = s->out_len = 0;
+    return 1;
+}
+
+/* connection error: tell the client why and close */
+static int session_error(h2_session_t *s, uint32_t code, const char *why)
+{
+    fprintf(stderr, "#session_error client fd %d: %s, going away with error %u\n", s->client.fd, why, code);
+    session_goaway(s, code);
+    // best effort, the connection is closed either way
+    if (session_flush(s) >= 0)
+        h2_session_close(s);
+    return -1;
+}
+
+static h2_stream_t *stream_find(h2_session_t *s, uint32_t id)
+{
+    h2_stream_t *st;
+
+    for (st = s->streams; st != NULL; st = st->next) {
+        if (st->id == id)
+            return st;
+    }
+    return NULL;
+}
+
+static void stream_close(h2_stream_t *st)
+{
+    h2_session_t *s = st->session;
+
+    if (st->closed)
+        return;
+    st->closed = 1;
+    if (st->prev != NULL)
+        st->prev->next = st->next;
+    else
+        s->streams = st->next;
+    if (st->next != NULL)
+        st->next->prev = st->prev;
+    s->nstreams--;
+    s->last_active = h2_now();
+    // the HTTP/1 side sees EOF and closes its end
+    event_close(s->loop, &st->backend);
+    bufpool_put(s->bufs, st->req, st->req_cap);
+    bufpool_put(s->bufs, st->resp, st->resp_cap);
+    st->req = st->resp = NULL;
+    // the backend handler may still be pending in the current batch
+    event_defer(s->loop, Free, st);
+}
+
+static void stream_reset(h2_stream_t *st, uint32_t code)
+{
+    fprintf(stderr, "#stream_reset stream %u of client fd %d with error %u\n", st->id, st->session->client.fd,
+            code);
+    session_rst_stream(st->session, st->id, code);
+    stream_close(st);
+}
+
+/* the response went out completely, a request still being sent is cut off (RFC 9113 8.1) */
+static void stream_done(h2_stream_t *st)
+{
+    if (!st->req_done)
+        session_rst_stream(st->session, st->id, H2_NO_ERROR);
+    stream_close(st);
+}
+
+static void stream_req_append(h2_stream_t *st, const char *buf, size_t n)
+{
+    if (st->req_len + n > st->req_cap) {
+        memmove(st->req, st->req + st->req_off, st->req_len - st->req_off);
+        st->req_len -= st->req_off;
+        st->req_off = 0;
+        if (st->req_len + n > st->req_cap)
+            st->req = bufpool_grow(st->session->bufs, st->req, st->req_len, &st->req_cap, st->req_len + n);
+    }
+    memcpy(st->req + st->req_len, buf, n);
+    st->req_len += n;
+}
+
+/* write the pending request bytes to the backend, the client's stream window opens by what got through */
+static void stream_write(h2_stream_t *st)
+{
+    ssize_t n;
+
+    while (st->req_off < st->req_len) {
+        if ((n = write(st->backend.fd, st->req + st->req_off, st->req_len - st->req_off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            // the HTTP/1 side answered without reading all of it, the rest is of no use
+            fprintf(stderr, "#stream_write stream %u drops %zu request bytes: %s\n", st->id,
+                    st->req_len - st->req_off, strerror(errno));
+            break;
+        }
+        st->req_off += n;
+    }
+    st->req_off = st->req_len = 0;
+    if (st->recv_unacked > 0 && !st->req_done) {
+        session_window_update(st->session, st->id, st->recv_unacked);
+        st->recv_window += st->recv_unacked;
+        st->recv_unacked = 0;
+    }
+}
+
+/* the client ended its side, a request body gets its last chunk */
+static void stream_end_request(h2_stream_t *st)
+{
+    st->req_done = 1;
+    if (st->req_body)
+        stream_req_append(st, CHUNK_LAST, CHUNK_LAST_LEN);
+    stream_write(st);
+}
+
+/* send a header block as HEADERS and as many CONTINUATION frames as the client's frame size needs */
+static void session_header_frames(h2_session_t *s, uint32_t id, const uint8_t *block, size_t len, int end_stream)
+{
+    int type = H2_HEADERS, flags;
+    size_t k;
+
+    do {
+        k = len < s->peer_max_frame ? len : s->peer_max_frame;
+        flags = (k == len ? H2_FLAG_END_HEADERS : 0) | (type == H2_HEADERS && end_stream ? H2_FLAG_END_STREAM : 0);
+        memcpy(session_frame(s, type, flags, id, k), block, k);
+        block += k;
+        len -= k;
+        type = H2_CONTINUATION;
+    } while (len > 0);
+}
+
+/* the backend gave no usable answer */
+static void stream_bad_gateway(h2_stream_t *st)
+{
+    uint8_t block[HPACK_FIELD_OVERHEAD];
+
+    fprintf(stderr, "#stream_bad_gateway stream %u of client fd %d got no response head\n", st->id,
+            st->session->client.fd);
+    session_header_frames(st->session, st->id, block, hpack_encode_status(block, 502), 1);
+    stream_done(st);
+}
+
+/* turn the HTTP/1.1 response head in head[0..len) into a header block, hop-by-hop fields left out */
+static void stream_send_head(h2_stream_t *st, const char *head, size_t len)
+{
+    h2_session_t *s = st->session;
+    const char *end = head + len, *line, *nl, *eol, *colon, *value;
+    size_t cap, n = 0;
+    uint8_t *block;
+    hdr_id_t id;
+
+    // a field takes at most its line plus HPACK_FIELD_OVERHEAD, and every line has at least 3 bytes
+    block = (uint8_t *) bufpool_get(s->bufs, len * 5 + HPACK_FIELD_OVERHEAD, &cap);
+    n = hpack_encode_status(block, st->parse.status);
+    for (line = memchr(head, '\n', len) + 1; line < end; line = nl + 1) {
+        nl = memchr(line, '\n', end - line);
+        eol = nl > line && nl[-1] == '\r' ? nl - 1 : nl;
+        // continuation lines of folded fields are not passed on
+        if (eol == line || *line == ' ' || *line == '\t' || (colon = memchr(line, ':', eol - line)) == NULL
+            || colon == line)
+            continue;
+        id = hdrtab_lookup(line, colon - line);
+        // hop-by-hop fields are left out, so is a Content-Length respparse found broken or overruled
+        if ((hdrtab[id].response & HDRTAB_DROP) || id == HDR_TRANSFER_ENCODING
+            || (id == HDR_CONTENT_LENGTH && (st->parse.bad_length || st->parse.nte > 0)))
+            continue;
+        for (value = colon + 1; value < eol && (*value == ' ' || *value == '\t'); value++);
+        while (eol > value && (eol[-1] == ' ' || eol[-1] == '\t'))
+            eol--;
+        n += hpack_encode_field(block + n, line, colon - line, value, eol - value);
+    }
+    session_header_frames(s, st->id, block, n, 0);
+    bufpool_put(s->bufs, (char *) block, cap);
+    st->head_sent = 1;
+}
+
+/* n new body bytes at resp + resp_len, kept there without their chunk framing */
+static void stream_body(h2_stream_t *st, size_t n)
+{
+    char *buf = st->resp + st->resp_len;
+    size_t out;
+
+    if (st->chunked) {
+        chunk_decode(&st->chunk, buf, n, buf, &out);
+        st->resp_len += out;
+        st->eof = st->chunk.done;
+    } else if (st->left >= 0) {
+        out = n < (size_t) st->left ? n : (size_t) st->left;
+        st->resp_len += out;
+        st->left -= out;
+        st->eof = st->left == 0;
+    } else {
+        st->resp_len += n;
+    }
+}
+
+/* bytes of the response head arrived, send it on once it is complete */
+static void stream_head(h2_stream_t *st)
+{
+    respparse_t *p = &st->parse;
+    size_t body;
+    int rc;
+
+    while ((rc = respparse_feed(p, st->resp, st->resp_len)) == RESPPARSE_DONE && p->status < 200) {
+        // interim answers (100 Continue ...) are not passed on
+        st->resp_len -= p->head_len;
+        memmove(st->resp, st->resp + p->head_len, st->resp_len);
+        respparse_init(p);
+    }
+    if (rc == RESPPARSE_ERROR || (rc == RESPPARSE_AGAIN && st->resp_len == st->resp_cap)) {
+        stream_bad_gateway(st);
+        return;
+    }
+    if (rc == RESPPARSE_AGAIN)
+        return;
+    stream_send_head(st, st->resp, p->head_len);
+    // the answer to HEAD ends with its head, whatever framing it announces
+    st->chunked = st->head_req ? 0 : p->chunked;
+    st->left = st->head_req ? 0 : p->chunked ? -1 : p->content_length;
+    st->eof = st->left == 0;
+    body = st->resp_len - p->head_len;
+    memmove(st->resp, st->resp + p->head_len, body);
+    st->resp_len = 0;
+    if (!st->eof)
+        stream_body(st, body);
+}
+
+/* the backend closed its end */
+static void stream_backend_eof(h2_stream_t *st)
+{
+    if (!st->head_sent) {
+        stream_bad_gateway(st);
+        return;
+    }
+    if (st->left > 0 || (st->chunked && !st->chunk.done)) {
+        fprintf(stderr, "#stream_backend_eof stream %u response body cut short\n", st->id);
+        stream_reset(st, H2_INTERNAL_ERROR);
+        return;
+    }
+    // a body delimited by closing ends here
+    st->eof = 1;
+}
+
+/* send buffered body bytes as DATA frames as far as both windows and the client's frame size allow */
+static void stream_send_data(h2_stream_t *st)
+{
+    h2_session_t *s = st->session;
+    size_t k;
+    int end;
+
+    while (st->resp_len > 0) {
+        k = st->resp_len < s->peer_max_frame ? st->resp_len : s->peer_max_frame;
+        if (st->send_window < (long) k)
+            k = st->send_window > 0 ? st->send_window : 0;
+        if (s->send_window < (long) k)
+            k = s->send_window > 0 ? s->send_window : 0;
+        if (k == 0) {
+            // a WINDOW_UPDATE of the stream pumps it, one of the connection pumps them all
+            return;
+        }
+        end = st->eof && k == st->resp_len;
+        memcpy(session_frame(s, H2_DATA, end ? H2_FLAG_END_STREAM : 0, st->id, k), st->resp, k);
+        st->resp_len -= k;
+        memmove(st->resp, st->resp + k, st->resp_len);
+        st->send_window -= k;
+        s->send_window -= k;
+        if (end) {
+            stream_done(st);
+            return;
+        }
+    }
+}
+
+/**
+ * read what the backend answered and send it on as HEADERS and DATA frames,
+ * until the backend would block, the windows are closed or the session
+ * outbuf is full (s->blocked, session_run pumps again once it drained)
+ */
+static void stream_pump(h2_stream_t *st)
+{
+    h2_session_t *s = st->session;
+    ssize_t n;
+
+    // after an upgrade nothing goes out for stream 1 before the client's preface and SETTINGS,
+    // which pump every stream, clients can't take much behind the 101
+    if (!s->preface)
+        return;
+    while (!st->closed) {
+        if (st->head_sent && st->resp_len > 0) {
+            stream_send_data(st);
+            if (st->closed)
+                return;
+        }
+        if (st->eof) {
+            if (st->resp_len == 0) {
+                session_frame(s, H2_DATA, H2_FLAG_END_STREAM, st->id, 0);
+                stream_done(st);
+            }
+            return;
+        }
+        if (st->resp_len == st->resp_cap)
+            return;
+        if (s->out_len - s->out_off >= H2_OUT_HIGH) {
+            s->blocked = 1;
+            return;
+        }
+        if ((n = read(st->backend.fd, st->resp + st->resp_len, st->resp_cap - st->resp_len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            fprintf(stderr, "#stream_pump read stream %u failed: %s\n", st->id, strerror(errno));
+            n = 0;
+        }
+        if (n == 0) {
+            stream_backend_eof(st);
+        } else if (!st->head_sent) {
+            st->resp_len += n;
+            stream_head(st);
+        } else {
+            stream_body(st, n);
+        }
+    }
+}
+
+static void stream_handler(event_handler_t *eh, unsigned int events)
+{
+    h2_stream_t *st = (h2_stream_t *) eh->data;
+    h2_session_t *s = st->session;
+
+    if (st->closed)
+        return;
+    stream_write(st);
+    stream_pump(st);
+    session_run(s);
+}
+
+/**
+ * open stream id and hand the other end of its socketpair to the backend
+ * @return the stream, NULL when it could not be set up
+ */
+static h2_stream_t *stream_open(h2_session_t *s, uint32_t id)
+{
+    h2_stream_t *st;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0) {
+        fprintf(stderr, "#stream_open socketpair for stream %u failed: %s\n", id, strerror(errno));
+        return NULL;
+    }
+    st = Calloc(1, sizeof(h2_stream_t));
+    st->id = id;
+    st->session = s;
+    st->backend.fd = sv[0];
+    st->backend.callback = stream_handler;
+    st->backend.data = st;
+    st->recv_window = H2_DEFAULT_WINDOW;
+    st->send_window = s->peer_window;
+    st->left = -1;
+    respparse_init(&st->parse);
+    chunk_init(&st->chunk);
+    st->resp = bufpool_get(s->bufs, H2_STREAM_BUFSIZE, &st->resp_cap);
+    st->next = s->streams;
+    if (s->streams != NULL)
+        s->streams->prev = st;
+    s->streams = st;
+    s->nstreams++;
+    s->last_active = h2_now();
+    if (event_add(s->loop, &st->backend, EVENT_READ | EVENT_WRITE) < 0) {
+        fprintf(stderr, "#stream_open event_add fd %d failed: %s\n", sv[0], strerror(errno));
+        close(sv[1]);
+        stream_close(st);
+        return NULL;
+    }
+    if (s->backend(s, sv[1]) < 0) {
+        stream_close(st);
+        return NULL;
+    }
+    fprintf(stderr, "#stream_open stream %u of client fd %d on fd %d, %d open\n", id, s->client.fd, sv[0],
+            s->nstreams);
+    return st;
+}
+
+/* an h2 field must be lower case, CR, LF and NUL would split the HTTP/1.1 request (RFC 9113 8.2.1) */
+static int field_valid(const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    size_t i;
+
+    if (name_len == 0)
+        return 0;
+    for (i = name[0] == ':'; i < name_len; i++) {
+        if (name[i] <= ' ' || name[i] >= 127 || name[i] == ':' || isupper((unsigned char) name[i]))
+            return 0;
+    }
+    for (i = 0; i < value_len; i++) {
+        if (value[i] == '\0' || value[i] == '\r' || value[i] == '\n')
+            return 0;
+    }
+    return 1;
+}
+
+/* whether s has no character that ends a request target or an authority */
+static int target_valid(const char *s, const char *stop)
+{
+    for (; *s != '\0'; s++) {
+        if ((unsigned char) *s <= ' ' || strchr(stop, *s) != NULL)
+            return 0;
+    }
+    return 1;
+}
+
+static void fields_append(h2_session_t *s, const char *buf, size_t n)
+{
+    if (s->fields_len + n > s->fields_cap)
+        s->fields = bufpool_grow(s->bufs, s->fields, s->fields_len, &s->fields_cap, s->fields_len + n);
+    memcpy(s->fields + s->fields_len, buf, n);
+    s->fields_len += n;
+}
+
+/* hpack_emit_t of request header blocks, regular fields go to s->fields as HTTP/1.1 lines */
+static int request_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    h2_request_t *req = (h2_request_t *) arg;
+    h2_session_t *s = req->session;
+    char **pseudo = NULL;
+    char *cookie;
+
+    // the block is decoded to the end either way, the dynamic table has to stay in step
+    if (req->bad)
+        return 0;
+    if (!field_valid(name, name_len, value, value_len)) {
+        req->bad = 1;
+        return 0;
+    }
+    if (name[0] == ':') {
+        if (name_len == 7 && memcmp(name, ":method", 7) == 0)
+            pseudo = &req->method;
+        else if (name_len == 5 && memcmp(name, ":path", 5) == 0)
+            pseudo = &req->path;
+        else if (name_len == 10 && memcmp(name, ":authority", 10) == 0)
+            pseudo = &req->authority;
+        else if (name_len != 7 || memcmp(name, ":scheme", 7) != 0)
+            req->bad = 1;
+        // pseudo headers come first, each of them once
+        if (req->fields_seen || (pseudo != NULL && *pseudo != NULL))
+            req->bad = 1;
+        else if (pseudo != NULL)
+            *pseudo = arena_strndup(&s->arena, value, value_len);
+        return 0;
+    }
+    req->fields_seen = 1;
+    if (name_len == 6 && memcmp(name, "cookie", 6) == 0) {
+        // h2 clients may split cookies into several fields (RFC 9113 8.2.3), HTTP/1.1 wants one line
+        cookie = arena_alloc(&s->arena, req->cookie_len + 2 + value_len + 1);
+        if (req->cookie_len > 0) {
+            memcpy(cookie, req->cookie, req->cookie_len);
+            memcpy(cookie + req->cookie_len, "; ", 2);
+            req->cookie_len += 2;
+        }
+        memcpy(cookie + req->cookie_len, value, value_len);
+        req->cookie_len += value_len;
+        cookie[req->cookie_len] = '\0';
+        req->cookie = cookie;
+        return 0;
+    }
+    switch (hdrtab_lookup(name, name_len)) {
+    case HDR_HOST:
+        // only stands in for a missing :authority, which comes first
+        if (req->authority == NULL)
+            req->authority = arena_strndup(&s->arena, value, value_len);
+        return 0;
+    case HDR_CONNECTION:
+    case HDR_KEEP_ALIVE:
+    case HDR_PROXY_CONNECTION:
+    case HDR_TRANSFER_ENCODING:
+    case HDR_UPGRADE:
+        // connection specific fields make an h2 request malformed (RFC 9113 8.2.2)
+        req->bad = 1;
+        return 0;
+    case HDR_TE:
+    case HDR_HTTP2_SETTINGS:
+        return 0;
+    case HDR_CONTENT_LENGTH:
+        // a body goes on in chunks
+        if (req->body)
+            return 0;
+        break;
+    default:
+        break;
+    }
+    fields_append(s, name, name_len);
+    fields_append(s, ": ", 2);
+    fields_append(s, value, value_len);
+    fields_append(s, "\r\n", 2);
+    return 0;
+}
+
+/* hpack_emit_t of trailer blocks, the fields are dropped */
+static int trailer_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    return 0;
+}
+
+/* write the HTTP/1.1 request of a new stream, absolute form so the proxy finds the server in the request line */
+static void stream_request(h2_stream_t *st, h2_request_t *req)
+{
+    h2_session_t *s = st->session;
+
+    stream_req_append(st, req->method, strlen(req->method));
+    stream_req_append(st, " http://", 8);
+    stream_req_append(st, req->authority, strlen(req->authority));
+    stream_req_append(st, req->path, strlen(req->path));
+    stream_req_append(st, " HTTP/1.1\r\nHost: ", 17);
+    stream_req_append(st, req->authority, strlen(req->authority));
+    stream_req_append(st, "\r\n", 2);
+    stream_req_append(st, s->fields, s->fields_len);
+    if (req->cookie != NULL) {
+        stream_req_append(st, "Cookie: ", 8);
+        stream_req_append(st, req->cookie, req->cookie_len);
+        stream_req_append(st, "\r\n", 2);
+    }
+    // the end of the response is the end of the stream, the HTTP/1 side must not wait for another request
+    stream_req_append(st, "Connection: close\r\n", 19);
+    if (req->body)
+        stream_req_append(st, "Transfer-Encoding: chunked\r\n", 28);
+    stream_req_append(st, "\r\n", 2);
+    st->req_body = req->body;
+    st->req_done = !req->body;
+    st->head_req = strcmp(req->method, "HEAD") == 0;
+}
+
+/* a complete header block for stream id */
+static int session_header_block(h2_session_t *s, uint32_t id, int flags, const uint8_t *block, size_t len)
+{
+    h2_stream_t *st;
+    h2_request_t req;
+    int rc;
+
+    if ((st = stream_find(s, id)) != NULL) {
+        // trailers of a request body
+        if (hpack_decode(&s->hpack, block, len, trailer_field, NULL) < 0)
+            return session_error(s, H2_COMPRESSION_ERROR, "bad header block");
+        if (st->req_done || !(flags & H2_FLAG_END_STREAM))
+            stream_reset(st, H2_PROTOCOL_ERROR);
+        else
+            stream_end_request(st);
+        return 0;
+    }
+    memset(&req, 0, sizeof(req));
+    req.session = s;
+    req.body = !(flags & H2_FLAG_END_STREAM);
+    s->fields_len = 0;
+    rc = hpack_decode(&s->hpack, block, len, request_field, &req);
+    if (rc < 0) {
+        arena_reset(&s->arena);
+        return session_error(s, H2_COMPRESSION_ERROR, "bad header block");
+    }
+    if (id <= s->last_stream) {
+        // a stream we already closed
+        arena_reset(&s->arena);
+        session_rst_stream(s, id, H2_STREAM_CLOSED);
+        return 0;
+    }
+    s->last_stream = id;
+    if (s->goaway || s->nstreams >= H2_MAX_STREAMS) {
+        arena_reset(&s->arena);
+        session_rst_stream(s, id, H2_REFUSED_STREAM);
+        return 0;
+    }
+    if (req.bad || req.method == NULL || req.path == NULL || req.authority == NULL || req.path[0] != '/'
+        || !target_valid(req.method, "") || !target_valid(req.path, "#")
+        || !target_valid(req.authority, "/?#@")) {
+        fprintf(stderr, "#session_header_block malformed request on stream %u of client fd %d\n", id,
+                s->client.fd);
+        arena_reset(&s->arena);
+        session_rst_stream(s, id, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+    if ((st = stream_open(s, id)) == NULL) {
+        arena_reset(&s->arena);
+        session_rst_stream(s, id, H2_REFUSED_STREAM);
+        return 0;
+    }
+    stream_request(st, &req);
+    arena_reset(&s->arena);
+    stream_write(st);
+    return 0;
+}
+
+/* the next piece of a header block, HEADERS or CONTINUATION */
+static int session_block(h2_session_t *s, const uint8_t *p, size_t len, int end)
+{
+    uint32_t id = s->block_stream;
+
+    // the usual block fits one frame and is decoded where it is
+    if (end && s->block_len == 0) {
+        s->block_stream = 0;
+        return session_header_block(s, id, s->block_flags, p, len);
+    }
+    if (s->block_len + len > H2_HEADER_BLOCK_MAX)
+        return session_error(s, H2_ENHANCE_YOUR_CALM, "header block too large");
+    if (s->block_len + len > s->block_cap)
+        s->block = bufpool_grow(s->bufs, s->block, s->block_len, &s->block_cap, s->block_len + len);
+    memcpy(s->block + s->block_len, p, len);
+    s->block_len += len;
+    if (!end)
+        return 0;
+    len = s->block_len;
+    s->block_stream = 0;
+    s->block_len = 0;
+    return session_header_block(s, id, s->block_flags, (uint8_t *) s->block, len);
+}
+
+/* remove the padding of a PADDED frame */
+static int strip_padding(int flags, const uint8_t **p, size_t *len)
+{
+    size_t pad;
+
+    if (!(flags & H2_FLAG_PADDED))
+        return 0;
+    if (*len < 1 || (pad = (*p)[0]) >= *len)
+        return -1;
+    (*p)++;
+    *len -= 1 + pad;
+    return 0;
+}
+
+static int session_data(h2_session_t *s, int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+    char line[CHUNK_HEAD_MAX];
+    size_t flow = len;
+    h2_stream_t *st;
+
+    if (id == 0 || strip_padding(flags, &p, &len) < 0)
+        return session_error(s, H2_PROTOCOL_ERROR, "bad DATA frame");
+    // the connection window opens right away, streams keep theirs closed until the backend took the bytes
+    if (flow > 0)
+        session_window_update(s, 0, flow);
+    if ((st = stream_find(s, id)) == NULL || st->req_done) {
+        if (id > s->last_stream)
+            return session_error(s, H2_PROTOCOL_ERROR, "DATA on an idle stream");
+        session_rst_stream(s, id, H2_STREAM_CLOSED);
+        return 0;
+    }
+    if ((long) flow > st->recv_window) {
+        stream_reset(st, H2_FLOW_CONTROL_ERROR);
+        return 0;
+    }
+    st->recv_window -= flow;
+    st->recv_unacked += flow;
+    if (len > 0) {
+        stream_req_append(st, line, chunk_head(line, len));
+        stream_req_append(st, (const char *) p, len);
+        stream_req_append(st, CHUNK_TAIL, CHUNK_TAIL_LEN);
+    }
+    if (flags & H2_FLAG_END_STREAM)
+        stream_end_request(st);
+    else
+        stream_write(st);
+    return 0;
+}
+
+static int session_headers(h2_session_t *s, int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+    if (id == 0 || !(id & 1) || strip_padding(flags, &p, &len) < 0)
+        return session_error(s, H2_PROTOCOL_ERROR, "bad HEADERS frame");
+    if (flags & H2_FLAG_PRIORITY) {
+        // priorities are not followed
+        if (len < 5)
+            return session_error(s, H2_PROTOCOL_ERROR, "bad HEADERS frame");
+        p += 5;
+        len -= 5;
+    }
+    s->block_stream = id;
+    s->block_flags = flags;
+    s->block_len = 0;
+    return session_block(s, p, len, flags & H2_FLAG_END_HEADERS);
+}
+
+/**
+ * apply a SETTINGS payload
+ * @return 0 or the error code of the connection error it causes
+ */
+static uint32_t session_apply_settings(h2_session_t *s, const uint8_t *p, size_t len)
+{
+    h2_stream_t *st;
+    uint32_t v;
+    size_t i;
+
+    for (i = 0; i + 6 <= len; i += 6) {
+        v = get32(p + i + 2);
+        switch (p[i] << 8 | p[i + 1]) {
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+            if (v > H2_WINDOW_MAX)
+                return H2_FLOW_CONTROL_ERROR;
+            // the change applies to the windows of the open streams as well (RFC 9113 6.9.2)
+            for (st = s->streams; st != NULL; st = st->next)
+                st->send_window += (long) v - s->peer_window;
+            s->peer_window = v;
+            break;
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if (v < H2_MAX_FRAME || v > H2_FRAME_LIMIT)
+                return H2_PROTOCOL_ERROR;
+            s->peer_max_frame = v;
+            break;
+        default:
+            // our encoder uses no dynamic table and never pushes, the rest does not matter to us
+            break;
+        }
+    }
+    return 0;
+}
+
+/* windows may have opened, every stream sends what it can */
+static void session_pump(h2_session_t *s)
+{
+    h2_stream_t *st, *next;
+
+    for (st = s->streams; st != NULL; st = next) {
+        next = st->next;
+        stream_pump(st);
+    }
+}
+
+static int session_settings(h2_session_t *s, int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+    uint32_t code;
+
+    if (id != 0)
+        return session_error(s, H2_PROTOCOL_ERROR, "SETTINGS on a stream");
+    if (flags & H2_FLAG_ACK)
+        return len == 0 ? 0 : session_error(s, H2_FRAME_SIZE_ERROR, "SETTINGS ack with payload");
+    if (len % 6 != 0)
+        return session_error(s, H2_FRAME_SIZE_ERROR, "bad SETTINGS frame");
+    if ((code = session_apply_settings(s, p, len)) != 0)
+        return session_error(s, code, "bad SETTINGS value");
+    session_frame(s, H2_SETTINGS, H2_FLAG_ACK, 0, 0);
+    session_pump(s);
+    return 0;
+}
+
+static int session_window(h2_session_t *s, uint32_t id, const uint8_t *p, size_t len)
+{
+    h2_stream_t *st;
+    uint32_t inc;
+
+    if (len != 4)
+        return session_error(s, H2_FRAME_SIZE_ERROR, "bad WINDOW_UPDATE frame");
+    inc = get32(p) & H2_WINDOW_MAX;
+    if (id == 0) {
+        if (inc == 0 || s->send_window + inc > H2_WINDOW_MAX)
+            return session_error(s, H2_FLOW_CONTROL_ERROR, "bad connection window");
+        s->send_window += inc;
+        session_pump(s);
+        return 0;
+    }
+    if ((st = stream_find(s, id)) == NULL)
+        return 0;
+    if (inc == 0 || st->send_window + inc > H2_WINDOW_MAX) {
+        stream_reset(st, inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+        return 0;
+    }
+    st->send_window += inc;
+    stream_pump(st);
+    return 0;
+}
+
+/**
+ * handle one frame from the client
+ * @return 0, -1 when the session was closed
+ */
+static int session_frame_in(h2_session_t *s, int type, int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+    h2_stream_t *st;
+
+    // nothing may come between the frames of a header block
+    if (s->block_stream != 0 && (type != H2_CONTINUATION || id != s->block_stream))
+        return session_error(s, H2_PROTOCOL_ERROR, "header block interrupted");
+    switch (type) {
+    case H2_DATA:
+        return session_data(s, flags, id, p, len);
+    case H2_HEADERS:
+        return session_headers(s, flags, id, p, len);
+    case H2_CONTINUATION:
+        if (s->block_stream == 0)
+            return session_error(s, H2_PROTOCOL_ERROR, "CONTINUATION without HEADERS");
+        return session_block(s, p, len, flags & H2_FLAG_END_HEADERS);
+    case H2_PRIORITY:
+        if (id == 0 || len != 5)
+            return session_error(s, H2_PROTOCOL_ERROR, "bad PRIORITY frame");
+        return 0;
+    case H2_RST_STREAM:
+        if (id == 0 || len != 4)
+            return session_error(s, H2_PROTOCOL_ERROR, "bad RST_STREAM frame");
+        if ((st = stream_find(s, id)) != NULL)
+            stream_close(st);
+        return 0;
+    case H2_SETTINGS:
+        return session_settings(s, flags, id, p, len);
+    case H2_PUSH_PROMISE:
+        return session_error(s, H2_PROTOCOL_ERROR, "PUSH_PROMISE from a client");
+    case H2_PING:
+        if (id != 0 || len != 8)
+            return session_error(s, H2_FRAME_SIZE_ERROR, "bad PING frame");
+        if (!(flags & H2_FLAG_ACK))
+            memcpy(session_frame(s, H2_PING, H2_FLAG_ACK, 0, 8), p, 8);
+        return 0;
+    case H2_GOAWAY:
+        // the client opens no more streams, the open ones are finished
+        s->goaway = 1;
+        return 0;
+    case H2_WINDOW_UPDATE:
+        return session_window(s, id, p, len);
+    default:
+        // unknown frame types are ignored
+        return 0;
+    }
+}
+
+/**
+ * handle every complete frame in inbuf
+ * @return 0, -1 when the session was closed
+ */
+static int session_process(h2_session_t *s)
+{
+    const uint8_t *f;
+    size_t pos = 0, len;
+
+    if (!s->preface) {
+        if (memcmp(s->inbuf, H2_PREFACE, s->in_len < H2_PREFACE_LEN ? s->in_len : H2_PREFACE_LEN) != 0)
+            return session_error(s, H2_PROTOCOL_ERROR, "no client preface");
+        if (s->in_len < H2_PREFACE_LEN)
+            return 0;
+        s->preface = 1;
+        pos = H2_PREFACE_LEN;
+    }
+    while (s->in_len - pos >= H2_FRAME_HEADER) {
+        f = (const uint8_t *) s->inbuf + pos;
+        len = f[0] << 16 | f[1] << 8 | f[2];
+        if (len > H2_MAX_FRAME)
+            return session_error(s, H2_FRAME_SIZE_ERROR, "frame too large");
+        if (s->in_len - pos < H2_FRAME_HEADER + len)
+            break;
+        if (session_frame_in(s, f[3], f[4], get32(f + 5) & H2_WINDOW_MAX, f + H2_FRAME_HEADER, len) < 0)
+            return -1;
+        pos += H2_FRAME_HEADER + len;
+    }
+    // a partial frame is moved to the front, inbuf always fits a whole one
+    memmove(s->inbuf, s->inbuf + pos, s->in_len - pos);
+    s->in_len -= pos;
+    return 0;
+}
+
+/**
+ * read everything the client sent
+ * @return 0, -1 when the session was closed
+ */
+static int session_read(h2_session_t *s)
+{
+    ssize_t n;
+
+    while (1) {
+        if ((n = read(s->client.fd, s->inbuf + s->in_len, s->in_cap - s->in_len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            fprintf(stderr, "#session_read read client fd %d failed: %s\n", s->client.fd, strerror(errno));
+            h2_session_close(s);
+            return -1;
+        }
+        if (n == 0) {
+            fprintf(stderr, "#session_read client fd %d closed with %d open streams\n", s->client.fd, s->nstreams);
+            h2_session_close(s);
+            return -1;
+        }
+        s->in_len += n;
+        if (session_process(s) < 0)
+            return -1;
+    }
+}
+
+/* write the queued frames, streams held back by a full outbuf go on once it drained */
+static void session_run(h2_session_t *s)
+{
+    size_t queued;
+
+    while (!s->closed) {
+        if (session_flush(s) < 0)
+            return;
+        if (!s->blocked || s->out_len - s->out_off >= H2_OUT_HIGH)
+            break;
+        s->blocked = 0;
+        queued = s->out_len - s->out_off;
+        session_pump(s);
+        if (s->out_len - s->out_off == queued)
+            break;
+    }
+    if (!s->closed && s->goaway && s->nstreams == 0 && s->out_off == s->out_len)
+        h2_session_close(s);
+}
+
+static void session_handler(event_handler_t *eh, unsigned int events)
+{
+    h2_session_t *s = (h2_session_t *) eh->data;
+
+    if (s->closed)
+        return;
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        h2_session_close(s);
+        return;
+    }
+    if (session_read(s) < 0)
+        return;
+    session_run(s);
+}
+
+h2_session_t *h2_session_create(event_loop_t *loop, bufpool_t *bufs, int fd, h2_backend_t backend,
+                                h2_closed_t on_close, void *data)
+{
+    h2_session_t *s = Calloc(1, sizeof(h2_session_t));
+    uint8_t *p;
+
+    s->loop = loop;
+    s->bufs = bufs;
+    s->client.fd = fd;
+    s->client.callback = session_handler;
+    s->client.data = s;
+    s->backend = backend;
+    s->on_close = on_close;
+    s->data = data;
+    hpack_init(&s->hpack);
+    arena_init(&s->arena, bufs);
+    s->send_window = H2_DEFAULT_WINDOW;
+    s->peer_window = H2_DEFAULT_WINDOW;
+    s->peer_max_frame = H2_MAX_FRAME;
+    s->last_active = h2_now();
+    if (event_add(loop, &s->client, EVENT_READ | EVENT_WRITE) < 0) {
+        fprintf(stderr, "#h2_session_create event_add fd %d failed: %s\n", fd, strerror(errno));
+        close(fd);
+        Free(s);
+        return NULL;
+    }
+    s->inbuf = bufpool_get(bufs, H2_FRAME_HEADER + H2_MAX_FRAME, &s->in_cap);
+    // our SETTINGS go first, they only limit the streams, the rest stays at its default
+    p = session_frame(s, H2_SETTINGS, 0, 0, 6);
+    p[0] = 0;
+    p[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(p + 2, H2_MAX_STREAMS);
+    fprintf(stderr, "#h2_session_create client fd %d speaks h2\n", fd);
+    return s;
+}
+
+int h2_session_upgrade_settings(h2_session_t *s, const char *value, size_t len)
+{
+    uint8_t payload[H2_UPGRADE_SETTINGS_MAX];
+    uint32_t bits = 0;
+    size_t i, n = 0;
+    int nbits = 0, c;
+
+    // base64url without padding (RFC 7540 3.2.1)
+    for (i = 0; i < len && value[i] != '='; i++) {
+        c = value[i];
+        if (c >= 'A' && c <= 'Z')
+            c -= 'A';
+        else if (c >= 'a' && c <= 'z')
+            c = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            c = c - '0' + 52;
+        else if (c == '-')
+            c = 62;
+        else if (c == '_')
+            c = 63;
+        else
+            return -1;
+        bits = bits << 6 | c;
+        if ((nbits += 6) >= 8) {
+            if (n == sizeof(payload))
+                return -1;
+            payload[n++] = bits >> (nbits - 8);
+            nbits -= 8;
+        }
+    }
+    if (n % 6 != 0 || session_apply_settings(s, payload, n) != 0)
+        return -1;
+    // the 101 acknowledges them
+    return 0;
+}
+
+int h2_session_upgrade_stream(h2_session_t *s, const char *head, size_t len)
+{
+    h2_stream_t *st;
+
+    if ((st = stream_open(s, 1)) == NULL) {
+        h2_session_close(s);
+        return -1;
+    }
+    s->last_stream = 1;
+    stream_req_append(st, head, len);
+    // the request came in full with the upgrade, stream 1 is half closed from the client's side
+    st->req_done = 1;
+    stream_write(st);
+    return 0;
+}
+
+void h2_session_start(h2_session_t *s, const char *buf, size_t n)
+{
+    size_t k;
+
+    while (n > 0) {
+        k = n < s->in_cap - s->in_len ? n : s->in_cap - s->in_len;
+        memcpy(s->inbuf + s->in_len, buf, k);
+        s->in_len += k;
+        buf += k;
+        n -= k;
+        if (session_process(s) < 0)
+            return;
+    }
+    // more may have come before the fd was registered, the edge triggered loop won't report it
+    if (session_read(s) < 0)
+        return;
+    session_run(s);
+}
+
+void h2_session_shutdown(h2_session_t *s)
+{
+    if (s->closed)
+        return;
+    session_goaway(s, H2_NO_ERROR);
+    s->goaway = 1;
+    session_run(s);
+}
+
+void h2_session_close(h2_session_t *s)
+{
+    if (s->closed)
+        return;
+    fprintf(stderr, "#h2_session_close close client fd %d with %d open streams\n", s->client.fd, s->nstreams);
+    s->closed = 1;
+    while (s->streams != NULL)
+        stream_close(s->streams);
+    event_close(s->loop, &s->client);
+    hpack_deinit(&s->hpack);
+    arena_release(&s->arena);
+    bufpool_put(s->bufs, s->inbuf, s->in_cap);
+    bufpool_put(s->bufs, s->outbuf, s->out_cap);
+    bufpool_put(s->bufs, s->block, s->block_cap);
+    bufpool_put(s->bufs, s->fields, s->fields_cap);
+    s->inbuf = s->outbuf = s->block = s->fields = NULL;
+    if (s->on_close != NULL)
+        s->on_close(s);
+    // the client handler may still be pending in the current batch
+    event_defer(s->loop, Free, s);
+}
@@ -0,0 +1,175 @@
+/* $begin h2.h */
+#ifndef __H2_H__
+#define __H2_H__
+
+#include <time.h>
+#include "event.h"
+#include "bufpool.h"
+#include "arena.h"
+#include "hpack.h"
+#include "respparse.h"
+#include "chunk.h"
+
+/* What every HTTP/2 client sends first, with prior knowledge or after the 101 */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+/* Bytes in front of every frame payload */
+#define H2_FRAME_HEADER 9
+
+/* Largest frame payload we accept (SETTINGS_MAX_FRAME_SIZE, never changed) */
+#define H2_MAX_FRAME 16384
+
+/* Streams a client may have open at once (SETTINGS_MAX_CONCURRENT_STREAMS) */
+#define H2_MAX_STREAMS 100
+
+/* Flow control window every connection and stream starts with */
+#define H2_DEFAULT_WINDOW 65535
+
+/* Largest header block, HEADERS plus CONTINUATION frames, a client may send */
+#define H2_HEADER_BLOCK_MAX 65536
+
+/* Session outbuf bytes above which streams stop reading their backends */
+#define H2_OUT_HIGH 65536
+
+/* Response bytes buffered per stream, the whole response head has to fit */
+#define H2_STREAM_BUFSIZE 16384
+
+typedef struct h2_session_t h2_session_t;
+
+/**
+ * hand the other end of a stream's socketpair to the HTTP/1 side, which
+ * reads the request the stream writes there and answers like to any client
+ * @return 0, -1 when fd could not be taken (it is closed by then)
+ */
+typedef int (*h2_backend_t)(h2_session_t *s, int fd);
+
+/**
+ * the session is closed, called once before it is freed
+ */
+typedef void (*h2_closed_t)(h2_session_t *s);
+
+/**
+ * one request/response exchange of a session. The request is written as
+ * HTTP/1.1 to our end of a socketpair, the response read back from it is
+ * turned into HEADERS and DATA frames.
+ */
+typedef struct h2_stream_t {
+    uint32_t id;
+    h2_session_t *session;
+    event_handler_t backend;    /* our end of the socketpair */
+    char *req;                  /* request head, then the body as chunks, still to be written */
+    size_t req_cap;
+    size_t req_len;
+    size_t req_off;
+    int req_body;               /* request body follows the head as chunks */
+    int req_done;               /* client ended its side of the stream */
+    int head_req;               /* HEAD request, the response carries no body */
+    long recv_window;           /* DATA bytes the client may still send */
+    long recv_unacked;          /* DATA bytes written to the backend, not given back to the window yet */
+    char *resp;                 /* response head while it is parsed, then body bytes not sent yet */
+    size_t resp_cap;
+    size_t resp_len;
+    respparse_t parse;
+    int head_sent;
+    int chunked;                /* backend sends the body in chunks, decoded before it goes out */
+    chunk_t chunk;
+    long left;                  /* body bytes still expected by Content-Length, -1 otherwise */
+    int eof;                    /* whole body read, nothing more comes from the backend */
+    long send_window;
+    int closed;
+    struct h2_stream_t *prev;
+    struct h2_stream_t *next;
+} h2_stream_t;
+
+/**
+ * server side of one HTTP/2 client connection, running on the event loop
+ * of the worker that accepted it. Requests of the client's streams go
+ * through the HTTP/1 path of the proxy (cache lookup, upstream pool ...),
+ * so h2 only does framing, HPACK and flow control.
+ */
+struct h2_session_t {
+    event_loop_t *loop;
+    bufpool_t *bufs;
+    event_handler_t client;
+    char *inbuf;                /* frames read from the client, not processed yet */
+    size_t in_cap;
+    size_t in_len;
+    int preface;                /* client preface received */
+    char *outbuf;               /* frames to be written to the client */
+    size_t out_cap;
+    size_t out_len;
+    size_t out_off;
+    hpack_t hpack;
+    char *block;                /* header block collected from HEADERS and CONTINUATION frames */
+    size_t block_cap;
+    size_t block_len;
+    uint32_t block_stream;      /* stream the header block belongs to, 0 when none is open */
+    int block_flags;            /* flags of its HEADERS frame */
+    arena_t arena;              /* pseudo headers and cookies of the header block being decoded */
+    char *fields;               /* regular request fields of the header block being decoded */
+    size_t fields_cap;
+    size_t fields_len;
+    long send_window;           /* connection flow control window of the client */
+    long peer_window;           /* client's SETTINGS_INITIAL_WINDOW_SIZE */
+    size_t peer_max_frame;      /* client's SETTINGS_MAX_FRAME_SIZE */
+    uint32_t last_stream;
+    h2_stream_t *streams;
+    int nstreams;
+    int blocked;                /* a stream stopped sending for a full outbuf or connection window */
+    int goaway;                 /* no new streams, close once the open ones are done */
+    int closed;
+    time_t last_active;         /* last time a stream was opened or finished */
+    h2_backend_t backend;
+    h2_closed_t on_close;
+    void *data;                 /* owner of the session */
+    struct h2_session_t *prev;
+    struct h2_session_t *next;
+};
+
+/**
+ * whether the first len bytes a client sent are the start of the HTTP/2
+ * preface, at least 4 are needed to tell
+ */
+int h2_is_preface(const char *buf, size_t len);
+
+/**
+ * take over the client connection fd, which must not be registered in loop,
+ * and send our SETTINGS
+ * @return the session, NULL when fd could not be registered (it is closed)
+ */
+h2_session_t *h2_session_create(event_loop_t *loop, bufpool_t *bufs, int fd, h2_backend_t backend,
+                                h2_closed_t on_close, void *data);
+
+/**
+ * apply the base64url SETTINGS payload of an HTTP2-Settings header, before
+ * h2_session_start
+ * @return 0, -1 when it is malformed
+ */
+int h2_session_upgrade_settings(h2_session_t *s, const char *value, size_t len);
+
+/**
+ * open stream 1 for the HTTP/1.1 request that asked for the upgrade, its
+ * head goes to the backend as it is and the client can't send more on it
+ * @return 0, -1 on failure (the session is closed)
+ */
+int h2_session_upgrade_stream(h2_session_t *s, const char *head, size_t len);
+
+/**
+ * process the n bytes the client already sent and start reading, the
+ * session may be closed when this returns
+ */
+void h2_session_start(h2_session_t *s, const char *buf, size_t n);
+
+/**
+ * tell the client we go away and close once the open streams are done
+ */
+void h2_session_shutdown(h2_session_t *s);
+
+/**
+ * close the session and all of its streams at once
+ */
+void h2_session_close(h2_session_t *s);
+
+#endif /* __H2_H__ */
+/* $end h2.h */
@@ -0,0 +1,207 @@
+#include <string.h>
+#include "hdrscan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef int (*hdrscan_fn)(hdrscan_t *, const char *, size_t, hdrscan_line_t *, int);
+
+/*
+ * handle one structural byte at off: a '\n' ends a line, only the first ':'
+ * of a line is kept
+ * @return 1 when a line was stored
+ */
+static inline int hdrscan_mark(hdrscan_t *s, const char *buf, size_t off, hdrscan_line_t *line)
+{
+    if (buf[off] == '\n') {
+        line->colon = s->colon;
+        line->nl = (uint32_t) off;
+        s->colon = HDRSCAN_NONE;
+        return 1;
+    }
+    if (s->colon == HDRSCAN_NONE)
+        s->colon = (uint32_t) off;
+    return 0;
+}
+
+/* portable version, memchr finds the line end and the colon inside the line */
+static int scan_scalar(hdrscan_t *s, const char *buf, size_t len, hdrscan_line_t *lines, int max)
+{
+    const char *nl, *colon;
+    int n = 0;
+
+    while (n < max && (nl = memchr(buf + s->pos, '\n', len - s->pos)) != NULL) {
+        if (s->colon == HDRSCAN_NONE && (colon = memchr(buf + s->pos, ':', nl - buf - s->pos)) != NULL)
+            s->colon = (uint32_t) (colon - buf);
+        lines[n].colon = s->colon;
+        lines[n].nl = (uint32_t) (nl - buf);
+        s->colon = HDRSCAN_NONE;
+        s->pos = nl + 1 - buf;
+        n++;
+    }
+    if (n < max) {
+        // unfinished line, only its colon is remembered
+        if (s->colon == HDRSCAN_NONE && (colon = memchr(buf + s->pos, ':', len - s->pos)) != NULL)
+            s->colon = (uint32_t) (colon - buf);
+        s->pos = len;
+    }
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * walk the set bits of mask, one per '\n' or ':' of the block at base
+ * @return lines stored so far, s->pos is set past the last one when max is reached
+ */
+static inline int scan_mask(hdrscan_t *s, const char *buf, size_t base, uint32_t mask,
+                            hdrscan_line_t *lines, int n, int max)
+{
+    size_t off;
+
+    while (mask != 0) {
+        off = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (hdrscan_mark(s, buf, off, &lines[n]) && ++n == max) {
+            s->pos = off + 1;
+            return n;
+        }
+    }
+    return n;
+}
+
+/* same as scan_mask for the bytes [i..len), when they are too few for a vector */
+static int scan_bytes(hdrscan_t *s, const char *buf, size_t i, size_t len, hdrscan_line_t *lines, int n, int max)
+{
+    for (; i < len; i++) {
+        if ((buf[i] == '\n' || buf[i] == ':') && hdrscan_mark(s, buf, i, &lines[n]) && ++n == max) {
+            s->pos = i + 1;
+            return n;
+        }
+    }
+    s->pos = len;
+    return n;
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t mask_sse2(const char *p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+
+    return (uint32_t) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                                     _mm_cmpeq_epi8(v, _mm_set1_epi8(':'))));
+}
+
+__attribute__((target("sse2")))
+static int scan_sse2(hdrscan_t *s, const char *buf, size_t len, hdrscan_line_t *lines, int max)
+{
+    size_t i = s->pos;
+    uint32_t mask;
+    int n = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        if ((mask = mask_sse2(buf + i)) != 0 && (n = scan_mask(s, buf, i, mask, lines, n, max)) == max)
+            return n;
+    }
+    s->pos = i;
+    if (i == len)
+        return n;
+    if (len < 16)
+        return scan_bytes(s, buf, i, len, lines, n, max);
+    // reading past len could fault, load the last 16 bytes instead and drop the ones seen already
+    mask = mask_sse2(buf + len - 16) >> (i - (len - 16));
+    if ((n = scan_mask(s, buf, i, mask, lines, n, max)) < max)
+        s->pos = len;
+    return n;
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t mask_avx2(const char *p)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+
+    return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':'))));
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2(hdrscan_t *s, const char *buf, size_t len, hdrscan_line_t *lines, int max)
+{
+    size_t i = s->pos;
+    uint32_t mask;
+    int n = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        if ((mask = mask_avx2(buf + i)) != 0 && (n = scan_mask(s, buf, i, mask, lines, n, max)) == max)
+            return n;
+    }
+    s->pos = i;
+    if (i == len)
+        return n;
+    if (len < 32)
+        return n + scan_sse2(s, buf, len, lines + n, max - n);
+    mask = mask_avx2(buf + len - 32) >> (i - (len - 32));
+    if ((n = scan_mask(s, buf, i, mask, lines, n, max)) < max)
+        s->pos = len;
+    return n;
+}
+
+/* what the CPU and the OS (saving the ymm registers) let us use */
+static int cpu_level(void)
+{
+    unsigned int eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+    int level = HDRSCAN_SCALAR;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return level;
+    if (edx & bit_SSE2)
+        level = HDRSCAN_SSE2;
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return level;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6)
+        return level;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2))
+        level = HDRSCAN_AVX2;
+    return level;
+}
+
+#else
+
+static int cpu_level(void)
+{
+    return HDRSCAN_SCALAR;
+}
+
+#endif
+
+static hdrscan_fn scan = scan_scalar;
+
+int hdrscan_init(int max)
+{
+    int level = cpu_level();
+
+    if (level > max)
+        level = max;
+#if defined(__x86_64__) || defined(__i386__)
+    scan = level == HDRSCAN_AVX2 ? scan_avx2 : level == HDRSCAN_SSE2 ? scan_sse2 : scan_scalar;
+#endif
+    return level;
+}
+
+const char *hdrscan_name(int impl)
+{
+    return impl == HDRSCAN_AVX2 ? "avx2" : impl == HDRSCAN_SSE2 ? "sse2" : "scalar";
+}
+
+void hdrscan_start(hdrscan_t *s, size_t pos)
+{
+    s->pos = pos;
+    s->colon = HDRSCAN_NONE;
+}
+
+int hdrscan_lines(hdrscan_t *s, const char *buf, size_t len, hdrscan_line_t *lines, int max)
+{
+    return scan(s, buf, len, lines, max);
+}
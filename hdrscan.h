@@ -0,0 +1,57 @@
+/* $begin hdrscan.h */
+#ifndef __HDRSCAN_H__
+#define __HDRSCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Scanner implementations, from the plainest to the widest */
+#define HDRSCAN_SCALAR 0
+#define HDRSCAN_SSE2 1          /* 16 bytes per step */
+#define HDRSCAN_AVX2 2          /* 32 bytes per step */
+
+/* colon of a line without any */
+#define HDRSCAN_NONE UINT32_MAX
+
+/* one line found by hdrscan_lines, offsets are from the start of the buffer */
+typedef struct hdrscan_line_t {
+    uint32_t colon;             /* first ':' of the line, HDRSCAN_NONE when it has none */
+    uint32_t nl;                /* the '\n' ending the line */
+} hdrscan_line_t;
+
+/**
+ * where a scan over a header block stands, so a block arriving in pieces
+ * is still looked at only once
+ */
+typedef struct hdrscan_t {
+    size_t pos;                 /* next byte to look at */
+    uint32_t colon;             /* first ':' seen so far in the unfinished line */
+} hdrscan_t;
+
+/**
+ * pick the widest scanner the CPU supports (asked with CPUID) up to max,
+ * until this is called the scalar one is used
+ * @param max HDRSCAN_SCALAR, HDRSCAN_SSE2 or HDRSCAN_AVX2
+ * @return the implementation now in use
+ */
+int hdrscan_init(int max);
+
+/**
+ * name of an implementation for logs
+ */
+const char *hdrscan_name(int impl);
+
+/**
+ * start scanning buf at offset pos
+ */
+void hdrscan_start(hdrscan_t *s, size_t pos);
+
+/**
+ * find the next complete lines of buf[s->pos..len) and the first ':' of
+ * each in a single pass, stops after max lines or at len
+ * @return number of lines stored in lines
+ */
+int hdrscan_lines(hdrscan_t *s, const char *buf, size_t len, hdrscan_line_t *lines, int max);
+
+#endif /* __HDRSCAN_H__ */
+/* $end hdrscan.h */
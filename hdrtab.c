@@ -0,0 +1,137 @@
+#include <string.h>
+#include <strings.h>
+#include "hdrtab.h"
+
+#define HDRTAB_ENTRY(id, name, request, response) [id] = { name, sizeof(name) - 1, request, response },
+const hdrtab_entry_t hdrtab[HDR_COUNT] = {
+    [HDR_UNKNOWN] = { "", 0, HDRTAB_PASS, HDRTAB_PASS },
+    HDRTAB_LIST(HDRTAB_ENTRY)
+};
+#undef HDRTAB_ENTRY
+
+hdr_id_t hdrtab_lookup(const char *name, size_t len)
+{
+    hdr_id_t id = HDR_UNKNOWN;
+
+    // the length and the first letter tell every known header apart
+    switch (len) {
+    case 2:
+        id = HDR_TE;
+        break;
+    case 3:
+        id = HDR_AGE;
+        break;
+    case 4:
+        switch (name[0] | 0x20) {
+        case 'h': id = HDR_HOST; break;
+        case 'e': id = HDR_ETAG; break;
+        case 'v': id = HDR_VARY; break;
+        }
+        break;
+    case 6:
+        switch (name[0] | 0x20) {
+        case 'a': id = HDR_ACCEPT; break;
+        case 'p': id = HDR_PRAGMA; break;
+        case 'e': id = HDR_EXPECT; break;
+        }
+        break;
+    case 7:
+        switch (name[0] | 0x20) {
+        case 'e': id = HDR_EXPIRES; break;
+        case 'u': id = HDR_UPGRADE; break;
+        case 't': id = HDR_TRAILER; break;
+        }
+        break;
+    case 10:
+        switch (name[0] | 0x20) {
+        case 'u': id = HDR_USER_AGENT; break;
+        case 'c': id = HDR_CONNECTION; break;
+        case 'k': id = HDR_KEEP_ALIVE; break;
+        case 's': id = HDR_SET_COOKIE; break;
+        }
+        break;
+    case 13:
+        switch (name[0] | 0x20) {
+        case 'c': id = HDR_CACHE_CONTROL; break;
+        case 'l': id = HDR_LAST_MODIFIED; break;
+        case 'a': id = HDR_AUTHORIZATION; break;
+        }
+        break;
+    case 14:
+        switch (name[0] | 0x20) {
+        case 'c': id = HDR_CONTENT_LENGTH; break;
+        case 'h': id = HDR_HTTP2_SETTINGS; break;
+        }
+        break;
+    case 15:
+        id = HDR_ACCEPT_ENCODING;
+        break;
+    case 16:
+        id = HDR_PROXY_CONNECTION;
+        break;
+    case 17:
+        id = HDR_TRANSFER_ENCODING;
+        break;
+    case 18:
+        id = HDR_PROXY_AUTHENTICATE;
+        break;
+    case 19:
+        id = HDR_PROXY_AUTHORIZATION;
+        break;
+    }
+    if (id != HDR_UNKNOWN && strncasecmp(name, hdrtab[id].name, len) != 0)
+        return HDR_UNKNOWN;
+    return id;
+}
+
+int hdrtab_has_token(const char *value, size_t len, const char *token)
+{
+    const char *p = value, *end = value + len, *e;
+    size_t n = strlen(token);
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if ((e = memchr(p, ',', end - p)) == NULL)
+            e = end;
+        // the element without its trailing whitespace
+        while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+            e--;
+        // a directive with an argument counts too: private="Set-Cookie" lists private
+        if (((size_t) (e - p) == n || ((size_t) (e - p) > n && p[n] == '=')) && strncasecmp(p, token, n) == 0)
+            return 1;
+        if ((p = memchr(p, ',', end - p)) == NULL)
+            break;
+    }
+    return 0;
+}
+
+int hdrtab_last_token(const char *value, size_t len, const char *token)
+{
+    const char *p, *e = value + len;
+    size_t n = strlen(token);
+
+    // skip empty elements and whitespace at the end of the list
+    while (e > value && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == ','))
+        e--;
+    for (p = e; p > value && p[-1] != ','; p--);
+    while (p < e && (*p == ' ' || *p == '\t'))
+        p++;
+    return (size_t) (e - p) == n && strncasecmp(p, token, n) == 0;
+}
+
+long hdrtab_content_length(const char *value, size_t len)
+{
+    long n = 0;
+    size_t i;
+
+    // 18 digits can't overflow a long
+    if (len == 0 || len > 18)
+        return -1;
+    for (i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9')
+            return -1;
+        n = n * 10 + (value[i] - '0');
+    }
+    return n;
+}
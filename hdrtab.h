@@ -0,0 +1,90 @@
+/* $begin hdrtab.h */
+#ifndef __HDRTAB_H__
+#define __HDRTAB_H__
+
+#include <stddef.h>
+
+/* What the proxy does with a header, per direction. PASS is no bit set */
+#define HDRTAB_PASS 0
+#define HDRTAB_DROP 1           /* not forwarded */
+#define HDRTAB_REPLACE 2        /* forwarded with the proxy's own line instead */
+#define HDRTAB_EXTRACT 4        /* the proxy reads its value */
+
+/**
+ * every header the proxy knows: id, name, action on client requests, action
+ * on server responses. A new entry also needs its case in hdrtab_lookup.
+ */
+#define HDRTAB_LIST(X) \
+    X(HDR_TE,                  "TE",                  HDRTAB_DROP,                      HDRTAB_PASS) \
+    X(HDR_AGE,                 "Age",                 HDRTAB_PASS,                      HDRTAB_PASS) \
+    X(HDR_HOST,                "Host",                HDRTAB_EXTRACT,                   HDRTAB_PASS) \
+    X(HDR_ETAG,                "ETag",                HDRTAB_PASS,                      HDRTAB_PASS) \
+    X(HDR_VARY,                "Vary",                HDRTAB_PASS,                      HDRTAB_EXTRACT) \
+    X(HDR_ACCEPT,              "Accept",              HDRTAB_REPLACE,                   HDRTAB_PASS) \
+    X(HDR_PRAGMA,              "Pragma",              HDRTAB_PASS,                      HDRTAB_EXTRACT) \
+    X(HDR_EXPECT,              "Expect",              HDRTAB_DROP | HDRTAB_EXTRACT,     HDRTAB_PASS) \
+    X(HDR_EXPIRES,             "Expires",             HDRTAB_PASS,                      HDRTAB_PASS) \
+    X(HDR_UPGRADE,             "Upgrade",             HDRTAB_DROP | HDRTAB_EXTRACT,     HDRTAB_DROP) \
+    X(HDR_TRAILER,             "Trailer",             HDRTAB_PASS,                      HDRTAB_PASS) \
+    X(HDR_USER_AGENT,          "User-Agent",          HDRTAB_REPLACE,                   HDRTAB_PASS) \
+    X(HDR_CONNECTION,          "Connection",          HDRTAB_REPLACE | HDRTAB_EXTRACT,  HDRTAB_DROP | HDRTAB_EXTRACT) \
+    X(HDR_KEEP_ALIVE,          "Keep-Alive",          HDRTAB_DROP,                      HDRTAB_DROP | HDRTAB_EXTRACT) \
+    X(HDR_SET_COOKIE,          "Set-Cookie",          HDRTAB_PASS,                      HDRTAB_EXTRACT) \
+    X(HDR_CACHE_CONTROL,       "Cache-Control",       HDRTAB_EXTRACT,                   HDRTAB_EXTRACT) \
+    X(HDR_LAST_MODIFIED,       "Last-Modified",       HDRTAB_PASS,                      HDRTAB_PASS) \
+    X(HDR_AUTHORIZATION,       "Authorization",       HDRTAB_EXTRACT,                   HDRTAB_PASS) \
+    X(HDR_CONTENT_LENGTH,      "Content-Length",      HDRTAB_EXTRACT,                   HDRTAB_EXTRACT) \
+    X(HDR_HTTP2_SETTINGS,      "HTTP2-Settings",      HDRTAB_DROP | HDRTAB_EXTRACT,     HDRTAB_PASS) \
+    X(HDR_ACCEPT_ENCODING,     "Accept-Encoding",     HDRTAB_REPLACE,                   HDRTAB_PASS) \
+    X(HDR_PROXY_CONNECTION,    "Proxy-Connection",    HDRTAB_DROP | HDRTAB_EXTRACT,     HDRTAB_DROP | HDRTAB_EXTRACT) \
+    X(HDR_TRANSFER_ENCODING,   "Transfer-Encoding",   HDRTAB_EXTRACT,                   HDRTAB_EXTRACT) \
+    X(HDR_PROXY_AUTHENTICATE,  "Proxy-Authenticate",  HDRTAB_PASS,                      HDRTAB_DROP) \
+    X(HDR_PROXY_AUTHORIZATION, "Proxy-Authorization", HDRTAB_DROP,                      HDRTAB_PASS)
+
+#define HDRTAB_ENUM(id, name, request, response) id,
+typedef enum hdr_id_t {
+    HDR_UNKNOWN,                /* any other header, passed on both ways */
+    HDRTAB_LIST(HDRTAB_ENUM)
+    HDR_COUNT
+} hdr_id_t;
+#undef HDRTAB_ENUM
+
+typedef struct hdrtab_entry_t {
+    const char *name;
+    unsigned char len;
+    unsigned char request;      /* HDRTAB_* bits for client requests */
+    unsigned char response;     /* HDRTAB_* bits for server responses */
+} hdrtab_entry_t;
+
+/* indexed by hdr_id_t, built by the compiler from HDRTAB_LIST */
+extern const hdrtab_entry_t hdrtab[HDR_COUNT];
+
+/**
+ * which header name[0..len) is (case insensitive), a switch on the length
+ * and one character picks the only candidate, a single compare confirms it
+ * @return its id, HDR_UNKNOWN for headers not in the table
+ */
+hdr_id_t hdrtab_lookup(const char *name, size_t len);
+
+/**
+ * whether the comma separated header value[0..len) lists token (case
+ * insensitive), like "close" in "Connection: keep-alive, close" or
+ * "private" in Cache-Control: private="Set-Cookie"
+ */
+int hdrtab_has_token(const char *value, size_t len, const char *token);
+
+/**
+ * whether the last element of the comma separated header value[0..len) is
+ * token (case insensitive), like chunked in "Transfer-Encoding: gzip, chunked"
+ */
+int hdrtab_last_token(const char *value, size_t len, const char *token);
+
+/**
+ * the length in a Content-Length value[0..len), which has to be a plain
+ * decimal number (no sign, no whitespace, no list)
+ * @return the length, -1 when the value is not usable
+ */
+long hdrtab_content_length(const char *value, size_t len);
+
+#endif /* __HDRTAB_H__ */
+/* $end hdrtab.h */
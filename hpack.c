@@ -0,0 +1,342 @@
+#include <ctype.h>
+#include <string.h>
+#include "csapp.h"
+#include "hpack.h"
+
+/* Entries of the static table (RFC 7541 Appendix A), index 62 is the newest dynamic entry */
+#define HPACK_STATIC_ENTRIES 61
+
+typedef struct hpack_static_t {
+    const char *name;
+    const char *value;
+} hpack_static_t;
+
+static const hpack_static_t static_table[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/*
+ * The Huffman code of RFC 7541 Appendix B is canonical: codes of one length
+ * are consecutive and in symbol order, so the number of codes per length and
+ * the symbols sorted by code are all the decoder needs (the way zlib's puff
+ * decodes deflate). Symbol 256 is EOS.
+ */
+#define HPACK_HUFF_EOS 256
+
+static const uint8_t huff_count[HPACK_HUFF_MAXLEN + 1] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const uint16_t huff_symbol[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256,
+};
+
+void hpack_init(hpack_t *h)
+{
+    h->first = 0;
+    h->count = 0;
+    h->size = 0;
+    h->max_size = HPACK_TABLE_SIZE;
+    h->scratch = NULL;
+    h->scratch_cap = 0;
+}
+
+void hpack_deinit(hpack_t *h)
+{
+    int i;
+
+    for (i = 0; i < h->count; i++)
+        Free(h->entries[(h->first + i) % HPACK_MAX_ENTRIES].name);
+    h->count = 0;
+    h->size = 0;
+    if (h->scratch != NULL)
+        Free(h->scratch);
+    h->scratch = NULL;
+    h->scratch_cap = 0;
+}
+
+/* drop the oldest entries until the table holds at most max bytes */
+static void table_evict(hpack_t *h, size_t max)
+{
+    hpack_entry_t *e;
+
+    while (h->count > 0 && h->size > max) {
+        e = &h->entries[(h->first + h->count - 1) % HPACK_MAX_ENTRIES];
+        h->size -= e->name_len + e->value_len + HPACK_ENTRY_OVERHEAD;
+        Free(e->name);
+        h->count--;
+    }
+}
+
+/* add a field as the newest entry, it may refer to an entry that gets evicted */
+static void table_add(hpack_t *h, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+    hpack_entry_t *e;
+    char *copy;
+
+    if (size > h->max_size) {
+        // too large for any table, it just empties it
+        table_evict(h, 0);
+        return;
+    }
+    copy = Malloc(name_len + value_len + 1);
+    memcpy(copy, name, name_len);
+    memcpy(copy + name_len, value, value_len);
+    table_evict(h, h->max_size - size);
+    h->first = (h->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    e = &h->entries[h->first];
+    e->name = copy;
+    e->name_len = name_len;
+    e->value = copy + name_len;
+    e->value_len = value_len;
+    h->count++;
+    h->size += size;
+}
+
+/* look up index (1-based, static entries first), -1 if there is no such entry */
+static int table_get(const hpack_t *h, size_t index, const char **name, size_t *name_len, const char **value,
+                     size_t *value_len)
+{
+    const hpack_entry_t *e;
+
+    if (index == 0)
+        return -1;
+    if (index <= HPACK_STATIC_ENTRIES) {
+        *name = static_table[index - 1].name;
+        *name_len = strlen(*name);
+        *value = static_table[index - 1].value;
+        *value_len = strlen(*value);
+        return 0;
+    }
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if (index >= (size_t) h->count)
+        return -1;
+    e = &h->entries[(h->first + index) % HPACK_MAX_ENTRIES];
+    *name = e->name;
+    *name_len = e->name_len;
+    *value = e->value;
+    *value_len = e->value_len;
+    return 0;
+}
+
+/* integer with an n bit prefix in the first byte (RFC 7541 5.1) */
+static int decode_int(const uint8_t **pos, const uint8_t *end, int n, size_t *out)
+{
+    const uint8_t *p = *pos;
+    size_t mask = (1u << n) - 1, v;
+    int shift = 0;
+
+    if (p >= end)
+        return -1;
+    v = *p++ & mask;
+    if (v == mask) {
+        do {
+            // more than 28 bits is nothing a header block of ours can hold
+            if (p >= end || shift > 21)
+                return -1;
+            v += (size_t) (*p & 127) << shift;
+            shift += 7;
+        } while (*p++ & 128);
+    }
+    *pos = p;
+    *out = v;
+    return 0;
+}
+
+/* Huffman decode len bytes to out, which has room for len * 8 / 5 bytes */
+static int huff_decode(const uint8_t *buf, size_t len, char *out, size_t *out_len)
+{
+    int code = 0, first = 0, index = 0, bits = 0, ones = 1, count, bit;
+    size_t i, o = 0;
+
+    for (i = 0; i < len; i++) {
+        for (bit = 7; bit >= 0; bit--) {
+            code |= (buf[i] >> bit) & 1;
+            ones &= (buf[i] >> bit) & 1;
+            bits++;
+            count = huff_count[bits];
+            if (code - count < first) {
+                if (huff_symbol[index + code - first] == HPACK_HUFF_EOS)
+                    return -1;
+                out[o++] = huff_symbol[index + code - first];
+                code = first = index = bits = 0;
+                ones = 1;
+                continue;
+            }
+            if (bits == HPACK_HUFF_MAXLEN)
+                return -1;
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+    }
+    // the last byte is padded with the high bits of EOS, all ones and less than a byte
+    if (bits > 7 || !ones)
+        return -1;
+    *out_len = o;
+    return 0;
+}
+
+/* string literal (RFC 7541 5.2), Huffman coded ones go to the scratch buffer at *scratch */
+static int decode_string(hpack_t *h, const uint8_t **pos, const uint8_t *end, size_t *scratch, const char **str,
+                         size_t *len)
+{
+    const uint8_t *p = *pos;
+    size_t n;
+    int huff;
+
+    if (p >= end)
+        return -1;
+    huff = *p & 128;
+    if (decode_int(&p, end, 7, &n) < 0 || n > (size_t) (end - p))
+        return -1;
+    if (huff) {
+        if (huff_decode(p, n, h->scratch + *scratch, len) < 0)
+            return -1;
+        *str = h->scratch + *scratch;
+        *scratch += *len;
+    } else {
+        *str = (const char *) p;
+        *len = n;
+    }
+    *pos = p + n;
+    return 0;
+}
+
+int hpack_decode(hpack_t *h, const uint8_t *buf, size_t len, hpack_emit_t emit, void *arg)
+{
+    const uint8_t *p = buf, *end = buf + len;
+    const char *name, *value;
+    size_t name_len, value_len, index, scratch;
+    int fields = 0, add;
+
+    // no string of the block decodes to more than 8 / 5 of its bytes
+    if (h->scratch_cap < len * 8 / 5 + 1) {
+        h->scratch_cap = len * 8 / 5 + 1;
+        h->scratch = Realloc(h->scratch, h->scratch_cap);
+    }
+    while (p < end) {
+        scratch = 0;
+        if (*p & 128) {
+            // indexed field
+            if (decode_int(&p, end, 7, &index) < 0
+                || table_get(h, index, &name, &name_len, &value, &value_len) < 0)
+                return -1;
+            if (emit(arg, name, name_len, value, value_len) < 0)
+                return -1;
+            fields++;
+            continue;
+        }
+        if ((*p & 0xe0) == 0x20) {
+            // dynamic table size update, only before the first field
+            if (fields > 0 || decode_int(&p, end, 5, &index) < 0 || index > HPACK_TABLE_SIZE)
+                return -1;
+            h->max_size = index;
+            table_evict(h, h->max_size);
+            continue;
+        }
+        // literal with incremental indexing (6 bit index), without indexing or never indexed (4 bit)
+        add = (*p & 64) != 0;
+        if (decode_int(&p, end, add ? 6 : 4, &index) < 0)
+            return -1;
+        if (index > 0) {
+            if (table_get(h, index, &name, &name_len, &value, &value_len) < 0)
+                return -1;
+        } else if (decode_string(h, &p, end, &scratch, &name, &name_len) < 0) {
+            return -1;
+        }
+        if (decode_string(h, &p, end, &scratch, &value, &value_len) < 0)
+            return -1;
+        if (emit(arg, name, name_len, value, value_len) < 0)
+            return -1;
+        if (add)
+            table_add(h, name, name_len, value, value_len);
+        fields++;
+    }
+    return 0;
+}
+
+/* integer with an n bit prefix behind the flag bits in first */
+static size_t encode_int(uint8_t *out, uint8_t first, int n, size_t v)
+{
+    size_t mask = (1u << n) - 1, len = 1;
+
+    if (v < mask) {
+        out[0] = first | v;
+        return 1;
+    }
+    out[0] = first | mask;
+    for (v -= mask; v >= 128; v >>= 7)
+        out[len++] = (v & 127) | 128;
+    out[len++] = v;
+    return len;
+}
+
+size_t hpack_encode_status(uint8_t *out, int status)
+{
+    size_t len;
+    int i;
+
+    for (i = 8; i <= 14; i++) {
+        if (atoi(static_table[i - 1].value) == status)
+            return encode_int(out, 128, 7, i);
+    }
+    // literal without indexing, name from the static :status entry
+    len = encode_int(out, 0, 4, 8);
+    out[len++] = 3;
+    out[len++] = '0' + status / 100 % 10;
+    out[len++] = '0' + status / 10 % 10;
+    out[len++] = '0' + status % 10;
+    return len;
+}
+
+size_t hpack_encode_field(uint8_t *out, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    size_t len = 0, i;
+
+    out[len++] = 0;
+    len += encode_int(out + len, 0, 7, name_len);
+    for (i = 0; i < name_len; i++)
+        out[len++] = tolower((unsigned char) name[i]);
+    len += encode_int(out + len, 0, 7, value_len);
+    memcpy(out + len, value, value_len);
+    return len + value_len;
+}
@@ -0,0 +1,77 @@
+/* $begin hpack.h */
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Dynamic table size the decoder allows (SETTINGS_HEADER_TABLE_SIZE, never changed) */
+#define HPACK_TABLE_SIZE 4096
+
+/* Every entry costs its name and value plus this overhead (RFC 7541 4.1) */
+#define HPACK_ENTRY_OVERHEAD 32
+
+/* Entries the dynamic table can hold at most */
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+/* Longest Huffman code */
+#define HPACK_HUFF_MAXLEN 30
+
+/* Bytes hpack_encode_field needs besides name and value */
+#define HPACK_FIELD_OVERHEAD 11
+
+typedef struct hpack_entry_t {
+    char *name;                 /* name and value share one allocation */
+    size_t name_len;
+    char *value;
+    size_t value_len;
+} hpack_entry_t;
+
+/**
+ * decoding side of one HTTP/2 connection: the dynamic table, newest entry
+ * first, as a ring of HPACK_MAX_ENTRIES slots
+ */
+typedef struct hpack_t {
+    hpack_entry_t entries[HPACK_MAX_ENTRIES];
+    int first;                  /* slot of the newest entry */
+    int count;
+    size_t size;                /* sum of the entry sizes */
+    size_t max_size;            /* set by the encoder's size updates, at most HPACK_TABLE_SIZE */
+    char *scratch;              /* Huffman decoded strings of the current block */
+    size_t scratch_cap;
+} hpack_t;
+
+/**
+ * called for every field of a decoded header block, name and value are only
+ * valid during the call
+ * @return 0 to go on, -1 to stop decoding (hpack_decode returns -1)
+ */
+typedef int (*hpack_emit_t)(void *arg, const char *name, size_t name_len, const char *value, size_t value_len);
+
+void hpack_init(hpack_t *h);
+void hpack_deinit(hpack_t *h);
+
+/**
+ * decode a complete header block and update the dynamic table
+ * @return 0, -1 on a malformed block (COMPRESSION_ERROR, the connection
+ *         can't go on) or when emit asked to stop
+ */
+int hpack_decode(hpack_t *h, const uint8_t *buf, size_t len, hpack_emit_t emit, void *arg);
+
+/**
+ * encode :status, indexed when the static table has it
+ * @param out at least HPACK_FIELD_OVERHEAD bytes
+ * @return bytes written
+ */
+size_t hpack_encode_status(uint8_t *out, int status);
+
+/**
+ * encode a field as a literal without indexing, the name lower cased, no
+ * Huffman coding. The encoder never uses the dynamic table.
+ * @param out at least name_len + value_len + HPACK_FIELD_OVERHEAD bytes
+ * @return bytes written
+ */
+size_t hpack_encode_field(uint8_t *out, const char *name, size_t name_len, const char *value, size_t value_len);
+
+#endif /* __HPACK_H__ */
+/* $end hpack.h */
@@ -1,8 +1,26 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <poll.h>
 #include "cache.h"
 #include "sbuf.h"
+#include "event.h"
+#include "connpool.h"
+#include "connector.h"
+#include "dnscache.h"
+#include "splicer.h"
+#include "affinity.h"
+#include "coro.h"
+#include "bufpool.h"
+#include "arena.h"
+#include "hdrscan.h"
+#include "hdrtab.h"
+#include "reqparse.h"
+#include "respparse.h"
+#include "chunk.h"
+#include "h2.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
@@ -10,31 +28,150 @@
 
 /**
  * here we define the request_t in which wraps the
- * domain, path, hdrs(header) and pathbuf 4 fields
+ * domain, path, hdrs(header) and pathbuf 4 fields, the server's host and port
+ * plus whether the client wants to keep its connection open
+ * and whether it speaks HTTP/1.1, the method and how its body is framed
  */
 typedef struct request_t {
+    char *method;
     char *domain;
+    char *host;
+    char *port;
     char *path;
     char *hdrs;
     char *pathbuf;
+    int keep_alive;
+    int http11;
+    int has_host;       /* client sent a Host header, hdrs carries it */
+    int no_cache;       /* the answer must not be stored: Authorization or Cache-Control: no-store */
+    int upgrade_h2c;    /* client asks to switch to h2c (Upgrade: h2c) */
+    char *h2_settings;  /* its HTTP2-Settings value, NULL without one */
+    long content_length; /* request body length, -1 without Content-Length */
+    int chunked;        /* request body comes as chunks (Transfer-Encoding: chunked) */
+    int expect_continue; /* client waits for 100 Continue before it sends the body */
 } request_t;
 
 typedef struct sockaddr_in sockaddr_in;
 typedef struct hostent hostent;
 
 /**
- * method request_processor used to process client requests
- * @param file descriptor
- * @param request body pointer
+ * every worker thread owns one event loop and multiplexes all of its client
+ * and server sockets on it, the acceptor round-robins new fds into the
+ * workers' own queues and kicks the owner's eventfd. A worker that finds its
+ * queue empty steals from the deepest queue of the others. In reuseport mode
+ * there is no acceptor, each worker accepts on its own SO_REUSEPORT listening
+ * socket instead.
+ * Between min_workers and max_workers the acceptor grows the pool when fds
+ * wait too long in the queues or a worker stops ticking, and retires the
+ * last worker after a quiet stretch.
  */
-int request_processor(int, request_t *);
+typedef struct worker_t {
+    int id;
+    pthread_t tid;
+    event_loop_t loop;
+    coro_sched_t sched;       /* runs the request phase of the worker's connections */
+    bufpool_t bufs;           /* request, response and cache buffers of the worker's connections */
+    sbuf_t queue;             /* accepted client fds waiting for this worker */
+    long queued;              /* fds the acceptor put into queue */
+    long steals;              /* fds this worker took from other workers' queues */
+    unsigned long wait_ms;    /* total ms adopted fds sat in a queue */
+    unsigned long waited;     /* number of adopted fds */
+    unsigned long wait_seen;  /* acceptor only: wait_ms and waited at the last pool decision */
+    unsigned long waited_seen;
+    long last_tick;           /* ms of the last timer tick, stale when the worker is blocked */
+    int running;              /* thread alive, the slot cannot be started again */
+    int retiring;             /* no more fds are dispatched, exit once every connection is gone */
+    event_handler_t notify;   /* eventfd written by the acceptor after sbuf_insert */
+    event_handler_t listener; /* reuseport mode only, worker's own listening socket */
+    event_handler_t timer;    /* periodic tick closing idle connections */
+    int listen_port;          /* > 0 means the worker opens listener itself */
+    struct conn_t *conns;     /* every open connection of this worker */
+    h2_session_t *sessions;   /* h2c client connections of this worker, see conn_h2_takeover */
+} worker_t;
 
 /**
- * method parse_req used to parse request body
- * @param char * buffer data read from client
- * @param request_t * extract and parse buffer data from buffer to request_t body
+ * states of the per-connection state machine driven by conn_run, a keep-alive
+ * connection goes back to CONN_READ_REQUEST once its response is written
  */
-int parse_req(char *, request_t *);
+typedef enum conn_state_t {
+    CONN_READ_REQUEST,   /* idle or accumulating the client's request head */
+    CONN_RESOLVE,        /* waiting for a resolver thread to look up the server */
+    CONN_CONNECT,        /* connector racing the server's addresses */
+    CONN_SEND_REQUEST,   /* writing the rebuilt request to the server */
+    CONN_SEND_BODY,      /* streaming the client's request body to the server */
+    CONN_RELAY_RESPONSE, /* copying server response to the client and cachebuf */
+    CONN_WRITE_RESPONSE, /* flushing the remaining response bytes to the client */
+    CONN_CLOSED
+} conn_state_t;
+
+/**
+ * one proxied client connection together with its server connection,
+ * all sockets are non-blocking and registered on the owner worker's loop
+ */
+typedef struct conn_t {
+    conn_state_t state;
+    worker_t *worker;
+    event_handler_t client;
+    event_handler_t server;
+    request_t request;
+    char *inbuf;        /* request head read from client, NUL terminated, from worker->bufs */
+    size_t in_cap;
+    size_t in_len;
+    reqparse_t *parser; /* head of the next request, from worker->bufs while it is parsed */
+    size_t parser_cap;
+    char *sendbuf;      /* request head to be written to server, from arena */
+    size_t send_len;
+    size_t send_off;
+    int req_body;       /* a request body follows the head, see conn_send_body */
+    long req_left;      /* request body bytes not seen yet by Content-Length */
+    chunk_t req_chunk;  /* position in a chunked request body */
+    size_t req_ready;   /* bytes at inbuf + head_len that belong to the body, not written to the server yet */
+    char *outbuf;       /* response bytes to be written to client, from worker->bufs */
+    size_t out_cap;     /* outbuf holds out_cap bytes plus RESP_HDR_SLACK + 1 */
+    size_t out_len;
+    size_t out_off;
+    int pending;        /* outbuf starts with answers to earlier pipelined requests, written first */
+    char *cachebuf;     /* copy of the response kept for the cache, grows up to MAX_OBJECT_SIZE */
+    size_t cache_cap;
+    size_t cache_len;
+    size_t cache_head;  /* length of the head at the start of cachebuf */
+    int no_cache;       /* response won't be cached, its bytes are not copied to cachebuf */
+    respparse_t resp;   /* response head parsed as it arrives */
+    size_t head_len;    /* bytes of inbuf taken by the current request head */
+    int head_done;      /* response head already rewritten and sent on */
+    int keep_alive;     /* connection stays open after this response */
+    long content_length; /* response body length, -1 when unknown */
+    int chunked;        /* response body uses chunked transfer-encoding */
+    int dechunk;        /* chunked body goes to the client decoded, it can't take chunks */
+    int enchunk;        /* body delimited by the server closing goes to the client as chunks */
+    size_t body_len;    /* response body bytes relayed so far */
+    int body_done;      /* whole response body seen, by Content-Length or last chunk */
+    chunk_t chunk;      /* position in a chunked body */
+    char *upstream;     /* "host:port" key of the server connection in upstream_pool, from arena */
+    char *upstream_host;
+    char *upstream_port;
+    int server_reused;  /* server fd was taken from upstream_pool */
+    int server_close;   /* server won't take another request on its connection */
+    dns_query_t dns;       /* server name lookup */
+    connector_t connector; /* non-blocking connect to upstream in progress */
+    splicer_t pipe;     /* kernel side relay of request bodies and of response bodies that won't be cached,
+                           opened on first use */
+    time_t last_active; /* last time the client made progress, or the response while it is relayed */
+    arena_t arena;      /* request strings, sendbuf and upstream of the current request */
+    coro_t *coro;       /* request phase in progress, see conn_request_main */
+    int internal;       /* client is an h2 stream of this worker, never switches to h2 itself */
+    struct conn_t *prev;
+    struct conn_t *next;
+} conn_t;
+
+/**
+ * method request_processor used to process client requests
+ * @param head buffer holding the request head read from client, not modified
+ * @param parser reqparse_feed of head returned REQPARSE_DONE
+ * @param request body pointer
+ * @param arena every string of request is allocated from it
+ */
+int request_processor(const char *, const reqparse_t *, request_t *, arena_t *);
 
 /**
  * print request body's inner 4 fields info
@@ -43,33 +180,106 @@ int parse_req(char *, request_t *);
 void show_request(request_t *);
 
 /**
- *  method to parse data from buffer and add data to $request_t#hdrs field
- *  @param buffer
+ *  method to decide how a client header line goes into $request_t#hdrs: our own
+ *  value for the headers the proxy sets, nothing for hop-by-hop ones, the line
+ *  itself otherwise, as hdrtab says for requests. Nothing is allocated.
+ *  @param id the header's hdrtab_lookup id
+ *  @param line header line including its CRLF
+ *  @param n length of line, set to the length of the returned line
  */
-char *head_parser(char *);
+const char *head_parser(hdr_id_t, const char *, size_t *);
 
 /**
  * proxy first communicate with the client enable port to listen to client's request
  * after receive requests from client proxy will parse it and validate the message
  * if the message is valid, then it will forward the request to server side by forward_request
- * @param file descriptor
- * @param request body
+ * on cache hit the response is served from cache, otherwise a server connection is
+ * opened and the connection moves on to CONN_SEND_REQUEST
+ * @param conn client connection with conn->request parsed ok
  */
-void forward_request(int, request_t);
-
-/**
- * method to release request's space and its member fields
- * @param request body
- */
-void free_request(request_t);
+void forward_request(conn_t *);
 
 /**
  * this is the sub-thread's method executor, we name it after java's runnable
  * everytime a thread is created from current's systems thread pool
- * it will be used to process client's request then a thread + runnable will be invoked.
+ * it runs the worker's event loop which serves all connections handed to it.
+ * @param vargp worker_t the thread serves
  */
 void *runnable(void *vargp);
 
+/**
+ * wrap an accepted client fd into a conn_t and register it on worker's loop
+ * @param worker owner worker
+ * @param fd client file descriptor, already in non-blocking mode
+ * @param internal fd is the socketpair end of an h2 stream, not a client socket
+ */
+void accept_conn(worker_t *, int, int);
+
+/**
+ * advance the connection state machine until it would block or is closed
+ * @param conn connection
+ */
+void conn_run(conn_t *);
+
+/**
+ * close both sides of the connection, the conn_t itself is released
+ * after the current event batch
+ * @param conn connection
+ */
+void conn_close(conn_t *);
+
+/**
+ * after a keep-alive response: drop the finished request and wait for the
+ * next one on the same client connection
+ * @param conn connection
+ */
+void conn_reset(conn_t *);
+
+/**
+ * wake worker's event loop so that it drains its queue
+ * @param worker worker to wake up
+ */
+void worker_notify(worker_t *);
+
+/**
+ * set up worker slot id and start its thread
+ * @param id index into workers
+ */
+void worker_start(int);
+
+/**
+ * grow or shrink the pool by one worker depending on the queue wait time
+ * and the number of blocked workers measured since the last call,
+ * runs on the acceptor thread every SCALE_INTERVAL
+ */
+void pool_scale(void);
+
+/**
+ * hand an accepted client fd to the next worker in round-robin order, a
+ * full queue passes the fd on to the next worker. If the owner is lagging
+ * behind its neighbour is woken as well to come steal.
+ * @param fd accepted client fd
+ */
+void worker_dispatch(int);
+
+/**
+ * take up to half of the deepest other worker's queue
+ * @param worker the idle worker
+ * @return number of fds stolen
+ */
+int worker_steal(worker_t *);
+
+/**
+ * event callbacks for the worker's eventfd, the client socket and the server socket
+ * @param eh registered handler
+ * @param events ready events reported by the loop
+ */
+void notify_handler(event_handler_t *, unsigned int);
+void listen_handler(event_handler_t *, unsigned int);
+void timer_handler(event_handler_t *, unsigned int);
+void client_handler(event_handler_t *, unsigned int);
+void server_handler(event_handler_t *, unsigned int);
+
 /**
  * if the request's path is cannot be found then it will let not_found_handler
  * method to process this condition.
@@ -150,22 +360,72 @@ int test_cache();
 // ---- test cases of caches ----
 
 
-static const char *accept_hdr = "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
-static const char *accept_encoding_hdr = "Accept-Encoding: gzip, deflate\r\n";
-static const char *conn_hdr = "Connection: close\r\n";
-static const char *prox_hdr = "Proxy-Connection: close\r\n";
-static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/105.0.0.0 Safari/537.36\r\n";
-
-#define THREAD_POOL_SIZE 3
-#define SHARED_BUFSIZE 16
-#define    MAXLINE     4096000
+/* our own line for every header hdrtab marks HDRTAB_REPLACE on requests */
+#define HDR_LINE(s) { s, sizeof(s) - 1 }
+static const struct {
+    const char *line;
+    size_t len;
+} replace_hdrs[HDR_COUNT] = {
+    [HDR_ACCEPT] = HDR_LINE("Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"),
+    [HDR_ACCEPT_ENCODING] = HDR_LINE("Accept-Encoding: gzip, deflate\r\n"),
+    [HDR_CONNECTION] = HDR_LINE("Connection: keep-alive\r\n"),
+    [HDR_USER_AGENT] = HDR_LINE("User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/105.0.0.0 Safari/537.36\r\n"),
+};
+static const char *keep_alive_resp_hdr = "Connection: keep-alive\r\n";
+static const char *close_resp_hdr = "Connection: close\r\n";
+static const char *chunked_resp_hdr = "Transfer-Encoding: chunked\r\n";
+static const char continue_resp[] = "HTTP/1.1 100 Continue\r\n\r\n";
+/* room reserved behind a response head for the headers we add and the framing of a first chunk */
+#define RESP_HDR_SLACK 96
+
+#define THREAD_POOL_SIZE 3      /* default min_workers */
+#define SHARED_BUFSIZE 16       /* default slots of every worker's queue */
+#define STEAL_THRESHOLD 2       /* queue depth at which the acceptor also wakes a thief */
+#define SCALE_INTERVAL 1000     /* ms between two pool size decisions */
+#define SCALE_UP_WAIT 20        /* avg ms fds waited in the queues that adds a worker */
+#define SCALE_DOWN_WAIT 1       /* avg ms below which an interval counts as quiet */
+#define SCALE_DOWN_ROUNDS 30    /* quiet intervals in a row before a worker is retired */
+#define BLOCKED_AFTER (2 * TIMER_INTERVAL)  /* ms without a tick that count a worker as blocked */
+#define DISPATCH_SLOTS_MAX (1 << 20)        /* fds beyond are not part of the queue wait measurement */
+#define REQUEST_HEAD_MAX 65536  /* longest request head accepted from a client */
+#define RELAY_BUFSIZE_MIN 16384 /* outbuf size for the response head, RESP_HDR_SLACK included */
+#define RELAY_BUFSIZE 65536     /* outbuf size once a body keeps coming, RESP_HDR_SLACK included */
+#define CACHEBUF_MIN 16384      /* first cachebuf size, it doubles up to MAX_OBJECT_SIZE */
+#define PIPELINE_BATCH_MAX 65536 /* outbuf bytes of pipelined answers collected before they are written */
+#define KEEPALIVE_TIMEOUT 15    /* seconds an idle client connection is kept */
+#define WRITE_STALL_TIMEOUT 60  /* seconds a response may go without a byte from the server or to the client */
+#define TIMER_INTERVAL 1000     /* ms between two idle connection sweeps */
 
 // =====
 sem_t w;
 void *cache;
 LRUCache *lruCache = NULL;
 LFUCache *lfuCache = NULL;
-sbuf_t sbuffer;
+connpool_t upstream_pool;   /* idle keep-alive server connections shared by all workers */
+dnscache_t dns_cache;       /* server name -> addresses, shared by all workers */
+worker_t *workers;          /* max_workers slots, the first nworkers take new fds */
+int nworkers = THREAD_POOL_SIZE;
+int min_workers = THREAD_POOL_SIZE;
+int max_workers = THREAD_POOL_SIZE;
+int queue_size = SHARED_BUFSIZE;
+int pin_workers = 0;        /* pin worker i to the i-th allowed CPU */
+unsigned int *dispatch_ms;  /* fd -> ms it was put into a queue, to measure queue wait */
+int dispatch_slots;
+int io_backend = EVENT_BACKEND_EPOLL;
+int connect_timeout = CONNECTOR_TIMEOUT;   /* ms an upstream connect may take */
+int h2c_mode = 0;           /* clients may speak h2c, by prior knowledge or Upgrade */
+
+static time_t now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 /**
  * in main entry we add two entry case
@@ -173,12 +433,26 @@ sbuf_t sbuffer;
  * argc == 2 argv[1] == lfu_test --> this will invoke lfu cache test cases logic
  * argc == 2 argv[1] == port --> this will setup the proxy with lru cache policy enabled in default
  * argc == 3 argv[1] == port && argv[2] == lfu --> this will setup the proxy with lfu cache policy enabled
+ * argc == 4 argv[3] == uring --> worker event loops run on io_uring instead of epoll (falls back to epoll
+ *                                if the kernel does not support it), argv[3] == epoll is the default
+ * argc == 5 argv[4] == reuseport --> one worker per core, each accepting on its own SO_REUSEPORT
+ *                                    listening socket, argv[4] == shared (default) keeps the single acceptor
+ * argc == 6 argv[5] == upstream connect timeout in ms (default CONNECTOR_TIMEOUT)
+ * argc == 7 argv[6] == worker count: N for a fixed pool or MIN-MAX to autoscale in between
+ *                      (default THREAD_POOL_SIZE-<number of CPUs>, reuseport mode runs MAX workers)
+ * argc == 8 argv[7] == slots of every worker's queue (default SHARED_BUFSIZE)
+ * argc == 9 argv[8] == pin --> pin every worker thread to its own CPU, argv[8] == nopin (default) doesn't
+ * argc == 10 argv[9] == h2c --> clients may also speak HTTP/2 over cleartext, with prior knowledge
+ *                               or by asking for an Upgrade: h2c
  */
 int main(int argc, char **argv) {
     int listen_port, listen_fd, conn_fd;
     unsigned client_len;
+    int reuseport = 0;
     sockaddr_in client_addr;
-    pthread_t tid;
+    struct pollfd pfd;
+    struct rlimit rl;
+    long last_scale;
 
     if (argc == 2 && strcmp(argv[1], "test") == 0) {
         fprintf(stderr, "#main test open file\n");
@@ -192,7 +466,8 @@ int main(int argc, char **argv) {
     }
 
     if (argc < 2) {
-        fprintf(stderr, "usage: %s <port> <cache policy>", argv[0]);
+        fprintf(stderr, "usage: %s <port> <cache policy> <epoll|uring> <shared|reuseport> <connect timeout ms> "
+                "<workers N|MIN-MAX> <queue size> <pin> <h2c>", argv[0]);
         exit(1);
     }
 
@@ -220,16 +495,61 @@ int main(int argc, char **argv) {
     }
 
     Sem_init(&w, 0, 1);
+    Signal(SIGPIPE, SIG_IGN);
     listen_port = atoi(argv[1]);
     fprintf(stdout, "listen on port %d with cache policy %s\n", listen_port, argv[2]);
 
+    if (argc >= 4 && strcmp(argv[3], "uring") == 0) {
+        io_backend = EVENT_BACKEND_URING;
+    }
+    fprintf(stdout, "worker event loops use %s backend\n", io_backend == EVENT_BACKEND_URING ? "io_uring" : "epoll");
+
+    if (argc >= 6 && atoi(argv[5]) > 0) {
+        connect_timeout = atoi(argv[5]);
+    }
+    fprintf(stdout, "upstream connect timeout %d ms\n", connect_timeout);
+
+    max_workers = affinity_ncpus();
+    if (max_workers < min_workers)
+        max_workers = min_workers;
+    if (argc >= 7) {
+        // "N" or "MIN-MAX"
+        char *dash = strchr(argv[6], '-');
+        min_workers = atoi(argv[6]);
+        max_workers = dash != NULL ? atoi(dash + 1) : min_workers;
+        if (min_workers < 1 || max_workers < min_workers) {
+            fprintf(stderr, "bad worker count %s, want N or MIN-MAX with 1 <= MIN <= MAX\n", argv[6]);
+            exit(1);
+        }
+    }
+    if (argc >= 8 && atoi(argv[7]) > 0) {
+        queue_size = atoi(argv[7]);
+    }
+    if (argc >= 9 && strcmp(argv[8], "pin") == 0) {
+        pin_workers = 1;
+    }
+    if (argc >= 10 && strcmp(argv[9], "h2c") == 0) {
+        h2c_mode = 1;
+        fprintf(stdout, "h2c enabled, prior knowledge and Upgrade: h2c\n");
+    }
+
+    if (argc >= 5 && strcmp(argv[4], "reuseport") == 0) {
+        // the kernel spreads connections over a fixed set of listeners, no autoscaling
+        reuseport = 1;
+        min_workers = max_workers;
+        fprintf(stdout, "reuseport mode: %d workers accept on their own listen fd\n", max_workers);
+    }
+    nworkers = min_workers;
+    fprintf(stdout, "worker pool %d-%d, queue size %d%s\n", min_workers, max_workers, queue_size,
+            pin_workers ? ", pinned to CPUs" : "");
+
     // we set lru is default policy
-    if (argc == 3 && strcmp(argv[2], "lfu") == 0) {
+    if (argc >= 3 && strcmp(argv[2], "lfu") == 0) {
         int ans = createLFUCache(1049000, &lfuCache);
         fprintf(stderr, "create lfu cache ret  %d pointer %p\n", ans, lfuCache);
     }
 
-    if (argc == 3 && strcmp(argv[2], "lru") == 0) {
+    if (argc >= 3 && strcmp(argv[2], "lru") == 0) {
         fprintf(stderr, "lfu cache is not init create default lru cache policy\n");
         int ans = createLRUCache(1049000, &lruCache);
         fprintf(stderr, "create lru cache ret %d pointer %p\n", ans, lruCache);
@@ -239,202 +559,1652 @@ int main(int argc, char **argv) {
         printLRUCache(lruCache);
     }
 
-    fprintf(stdout, "init shared buffer with size %d", SHARED_BUFSIZE);
-    sbuf_init(&sbuffer, SHARED_BUFSIZE);
-    fprintf(stdout, "open listen fd to port %d\n", listen_port);
-    listen_fd = Open_listenfd(listen_port);
-    client_len = sizeof(client_addr);
+    connpool_init(&upstream_pool);
+    dnscache_init(&dns_cache);
+    fprintf(stderr, "#main header scanning uses %s\n", hdrscan_name(hdrscan_init(HDRSCAN_AVX2)));
+
+    // queue wait is measured per fd, fds never reach the open file limit (pages of unused slots stay untouched)
+    dispatch_slots = DISPATCH_SLOTS_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < DISPATCH_SLOTS_MAX)
+        dispatch_slots = (int) rl.rlim_cur;
+    dispatch_ms = Calloc(dispatch_slots, sizeof(unsigned int));
+
+    // --> load thread pool, every slot up to max_workers gets its queue now so that it never moves,
+    // queue indices are cache line aligned, so is the array
+    if ((workers = aligned_alloc(SBUF_CACHELINE, max_workers * sizeof(worker_t))) == NULL)
+        unix_error("workers aligned_alloc error");
+    memset(workers, 0, max_workers * sizeof(worker_t));
+    for (int i = 0; i < max_workers; i++) {
+        workers[i].id = i;
+        sbuf_init(&workers[i].queue, queue_size);
+        workers[i].listen_port = reuseport ? listen_port : 0;
+    }
+    for (int i = 0; i < nworkers; i++)
+        worker_start(i);
 
-    // --> load thread pool
-    for (int i = 0; i < THREAD_POOL_SIZE; i++) {
-        fprintf(stdout, "Pthread_create with index %d\n", i);
-        Pthread_create(&tid, NULL, runnable, &client_addr);
-        fprintf(stderr, "Pthread_create thread tid %ld\n", tid);
+    if (reuseport) {
+        // workers accept by themselves, nothing left for the main thread
+        while (1)
+            pause();
     }
 
+    fprintf(stdout, "open listen fd to port %d\n", listen_port);
+    listen_fd = Open_listenfd(listen_port);
+    client_len = sizeof(client_addr);
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    last_scale = now_ms();
     while (1) {
+        // the acceptor also sizes the pool, so it never sleeps longer than SCALE_INTERVAL
+        if (min_workers < max_workers && now_ms() - last_scale >= SCALE_INTERVAL) {
+            pool_scale();
+            last_scale = now_ms();
+        }
+        if (poll(&pfd, 1, min_workers < max_workers ? SCALE_INTERVAL : -1) <= 0)
+            continue;
         fprintf(stdout, "Accept with listen on port %d listen fd %d\n", listen_port, listen_fd);
         conn_fd = Accept(listen_fd, (SA *) &client_addr, &client_len);
-        sbuf_insert(&sbuffer, conn_fd);
+        worker_dispatch(conn_fd);
     }
 
     return 0;
 }
 
-int request_processor(int fd, request_t *request) {
-    size_t n;
-    char buf[MAXLINE];
-    rio_t rio;
+int request_processor(const char *head, const reqparse_t *parser, request_t *request, arena_t *arena) {
+    size_t n, total = 0;
+    long len;
+    const char *hdr, *line, *value;
+    const reqparse_slice_t *host = &parser->host;
+    unsigned char ids[REQPARSE_MAX_HEADERS];
+    char *buf;
+    int i, te = 0;
+
+    fprintf(stdout, "#request_processor gonna process request head %.*s\n", (int) parser->head_len, head);
+
+    // the parser only pointed into head, copy out what outlives the buffer
+    request->method = arena_strndup(arena, head + parser->method.off, parser->method.len);
+    request->pathbuf = arena_strndup(arena, head + parser->uri.off, parser->uri.len);
+    request->domain = arena_strndup(arena, head + host->off,
+                                    parser->port.len ? parser->port.off + parser->port.len - host->off : host->len);
+    // an IPv6 literal goes to the resolver without its brackets
+    if (host->len > 2 && head[host->off] == '[')
+        request->host = arena_strndup(arena, head + host->off + 1, host->len - 2);
+    else
+        request->host = arena_strndup(arena, head + host->off, host->len);
+    request->port = parser->port.len ? arena_strndup(arena, head + parser->port.off, parser->port.len) : NULL;
+    // the cache key and the rebuilt request line go without the leading '/'
+    n = parser->path.len;
+    request->path = arena_strndup(arena, head + parser->path.off + (n > 0), n - (n > 0));
+    // HTTP/1.1 clients keep the connection unless they say close, HTTP/1.0 ones only on request
+    request->http11 = parser->http_minor >= 1;
+    request->keep_alive = request->http11;
+    request->has_host = 0;
+    request->no_cache = 0;
+    request->upgrade_h2c = 0;
+    request->h2_settings = NULL;
+    request->content_length = -1;
+    request->chunked = 0;
+    request->expect_continue = 0;
+
+    // parse header info: learn the client's own Connection choice and size the rebuilt headers
+    for (i = 0; i < parser->nheaders; i++) {
+        ids[i] = hdrtab_lookup(head + parser->headers[i].name.off, parser->headers[i].name.len);
+        line = head + parser->headers[i].line.off;
+        value = head + parser->headers[i].value.off;
+        n = parser->headers[i].value.len;
+        if (hdrtab[ids[i]].request & HDRTAB_EXTRACT) {
+            switch (ids[i]) {
+            case HDR_CONNECTION:
+            case HDR_PROXY_CONNECTION:
+                if (hdrtab_has_token(value, n, "close"))
+                    request->keep_alive = 0;
+                else if (hdrtab_has_token(value, n, "keep-alive"))
+                    request->keep_alive = 1;
+                break;
+            case HDR_HOST:
+                request->has_host = 1;
+                break;
+            case HDR_AUTHORIZATION:
+                // a shared cache must not hand one user's answer to another
+                request->no_cache = 1;
+                break;
+            case HDR_CACHE_CONTROL:
+                if (hdrtab_has_token(value, n, "no-store"))
+                    request->no_cache = 1;
+                break;
+            case HDR_UPGRADE:
+                if (hdrtab_has_token(value, n, "h2c"))
+                    request->upgrade_h2c = 1;
+                break;
+            case HDR_HTTP2_SETTINGS:
+                request->h2_settings = arena_strndup(arena, value, n);
+                break;
+            case HDR_CONTENT_LENGTH:
+                // the body is relayed by this length, a broken or second different one leaves its end unknown
+                if ((len = hdrtab_content_length(value, n)) < 0
+                    || (request->content_length >= 0 && request->content_length != len)) {
+                    fprintf(stderr, "#request_processor bad Content-Length %.*s\n", (int) n, value);
+                    return -1;
+                }
+                request->content_length = len;
+                break;
+            case HDR_TRANSFER_ENCODING:
+                // several lines make one list, the last line has the last coding
+                te = 1;
+                request->chunked = hdrtab_last_token(value, n, "chunked");
+                break;
+            case HDR_EXPECT:
+                if (hdrtab_has_token(value, n, "100-continue"))
+                    request->expect_continue = 1;
+                break;
+            default:
+                break;
+            }
+        }
+        n = parser->headers[i].line.len;
+        head_parser(ids[i], line, &n);
+        total += n;
+    }
+    // any other coding has to be followed by chunked, otherwise nothing tells where the body ends
+    if (te && !request->chunked) {
+        fprintf(stderr, "#request_processor Transfer-Encoding of the request does not end with chunked\n");
+        return -1;
+    }
+    // both framings at once is how requests are smuggled past a proxy, refuse them
+    if (request->chunked && request->content_length >= 0) {
+        fprintf(stderr, "#request_processor request has both Content-Length and Transfer-Encoding\n");
+        return -1;
+    }
+    // then copy them once, head_parser rewrites Connection etc. for the server
+    request->hdrs = arena_alloc(arena, total + 1);
+    buf = request->hdrs;
+    for (i = 0; i < parser->nheaders; i++) {
+        n = parser->headers[i].line.len;
+        hdr = head_parser(ids[i], head + parser->headers[i].line.off, &n);
+        memcpy(buf, hdr, n);
+        buf += n;
+    }
+    *buf = '\0';
+    fprintf(stdout, "#request_processor got request->hdrs content %s", request->hdrs);
+    return 0;
+}
 
-    fprintf(stdout, "#request_processor gonna process fd %d request#domain %s request#hdrs %s,"
-                    "request#path %s, request#pathbuf %s\n",
-            fd, request->domain, request->hdrs, request->path, request->pathbuf);
 
-    request->domain = NULL;
-    request->path = NULL;
-    request->hdrs = NULL;
+void *runnable(void *vargp) {
+    worker_t *worker = (worker_t *) vargp;
+    int cpu;
+    Pthread_detach(pthread_self());
 
-    // first parse domain and path thoese two fields
-    Rio_readinitb(&rio, fd);
-    if ((n = Rio_readlineb(&rio, buf, MAXLINE)) != 0) {
-        if (parse_req(buf, request) == -1) {
-            return -1;
-        }
+    if (pin_workers) {
+        if ((cpu = affinity_pin(worker->id)) < 0)
+            fprintf(stderr, "#runnable cannot pin worker %d: %s\n", worker->id, strerror(errno));
+        else
+            fprintf(stdout, "proxy#runnable worker %d pinned to cpu %d\n", worker->id, cpu);
+    }
+
+    // io_uring rings only accept submissions from the thread that created them
+    event_loop_init(&worker->loop, io_backend);
+    coro_sched_init(&worker->sched);
+    bufpool_init(&worker->bufs);
+    if (event_add(&worker->loop, &worker->notify, EVENT_READ) < 0)
+        unix_error("event_add notify error");
+    worker->timer.callback = timer_handler;
+    worker->timer.data = worker;
+    if (event_add_timer(&worker->loop, &worker->timer, TIMER_INTERVAL) < 0)
+        unix_error("event_add_timer error");
+    if (worker->listen_port > 0) {
+        worker->listener.fd = Open_listenfd_reuseport(worker->listen_port);
+        if (event_add_io(&worker->loop, &worker->listener) < 0)
+            unix_error("event_add_io listener error");
+        fprintf(stdout, "proxy#runnable worker %d listen fd %d on port %d\n", worker->id, worker->listener.fd,
+                worker->listen_port);
+        // io_uring accepts only once asked to, the first call arms it
+        listen_handler(&worker->listener, 0);
+    }
+    fprintf(stdout, "proxy#runnable thread id %ld runs event loop of worker %d\n", pthread_self(), worker->id);
+    event_loop_run(&worker->loop);
+
+    // retired, every connection is gone and no fd is dispatched to us anymore
+    event_close(&worker->loop, &worker->timer);
+    event_close(&worker->loop, &worker->notify);
+    event_loop_deinit(&worker->loop);
+    coro_sched_deinit(&worker->sched);
+    bufpool_deinit(&worker->bufs);
+    fprintf(stdout, "proxy#runnable worker %d retired, %ld fds queued %ld stolen\n", worker->id,
+            worker->queued, worker->steals);
+    __atomic_store_n(&worker->running, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void worker_start(int id) {
+    worker_t *worker = &workers[id];
+
+    worker->queued = worker->steals = 0;
+    worker->wait_ms = worker->waited = worker->wait_seen = worker->waited_seen = 0;
+    worker->last_tick = now_ms();
+    worker->retiring = 0;
+    worker->conns = NULL;
+    worker->sessions = NULL;
+    memset(&worker->loop, 0, sizeof(worker->loop));
+    if ((worker->notify.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        unix_error("eventfd error");
+    worker->notify.callback = notify_handler;
+    worker->notify.data = worker;
+    worker->listener.fd = -1;
+    worker->listener.callback = listen_handler;
+    worker->listener.data = worker;
+    worker->running = 1;
+    fprintf(stdout, "Pthread_create with index %d\n", id);
+    Pthread_create(&worker->tid, NULL, runnable, worker);
+    fprintf(stderr, "Pthread_create thread tid %ld\n", worker->tid);
+}
+
+void pool_scale(void) {
+    static int quiet = 0;
+    unsigned long wait_ms = 0, waited = 0, w, n;
+    long now = now_ms(), avg;
+    int i, blocked = 0;
+    worker_t *worker;
+
+    for (i = 0; i < nworkers; i++) {
+        worker = &workers[i];
+        w = __atomic_load_n(&worker->wait_ms, __ATOMIC_RELAXED);
+        n = __atomic_load_n(&worker->waited, __ATOMIC_RELAXED);
+        wait_ms += w - worker->wait_seen;
+        waited += n - worker->waited_seen;
+        worker->wait_seen = w;
+        worker->waited_seen = n;
+        if (now - __atomic_load_n(&worker->last_tick, __ATOMIC_RELAXED) > BLOCKED_AFTER)
+            blocked++;
+    }
+    avg = waited > 0 ? (long) (wait_ms / waited) : 0;
+
+    if ((avg >= SCALE_UP_WAIT || blocked > 0) && nworkers < max_workers) {
+        quiet = 0;
+        // a retired worker still closing its last connections keeps its slot
+        if (__atomic_load_n(&workers[nworkers].running, __ATOMIC_ACQUIRE))
+            return;
+        worker_start(nworkers);
+        __atomic_store_n(&nworkers, nworkers + 1, __ATOMIC_RELEASE);
+        fprintf(stderr, "#pool_scale queue wait %ld ms, %d blocked workers, grow to %d workers\n", avg, blocked,
+                nworkers);
+    } else if (avg <= SCALE_DOWN_WAIT && blocked == 0 && nworkers > min_workers) {
+        if (++quiet < SCALE_DOWN_ROUNDS)
+            return;
+        quiet = 0;
+        // stop dispatching to the last worker first, then let it drain and exit
+        __atomic_store_n(&nworkers, nworkers - 1, __ATOMIC_RELEASE);
+        worker = &workers[nworkers];
+        __atomic_store_n(&worker->retiring, 1, __ATOMIC_RELEASE);
+        fprintf(stderr, "#pool_scale queue wait %ld ms, shrink to %d workers\n", avg, nworkers);
     } else {
-        return -1;
+        quiet = 0;
     }
+}
+
+void worker_notify(worker_t *worker) {
+    uint64_t one = 1;
 
-    // parse header info
-    while ((n = Rio_readlineb(&rio, buf, MAXLINE)) != 0) {
-        if (strcmp(buf, "\r\n") == 0) {
+    if (write(worker->notify.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        unix_error("worker_notify write error");
+}
+
+void worker_dispatch(int fd) {
+    static unsigned int next_worker = 0;
+    worker_t *worker = NULL;
+    int i;
+
+    // only the acceptor thread dispatches, next_worker needs no atomics
+    if (fd < dispatch_slots)
+        dispatch_ms[fd] = (unsigned int) now_ms();
+    for (i = 0; i < nworkers; i++) {
+        worker = &workers[(next_worker + i) % nworkers];
+        if (sbuf_try_insert(&worker->queue, fd) == 0)
             break;
+    }
+    if (i == nworkers) {
+        // every queue is full, wait for the round-robin owner to make room
+        worker = &workers[next_worker % nworkers];
+        sbuf_insert(&worker->queue, fd);
+    }
+    next_worker++;
+    __atomic_fetch_add(&worker->queued, 1, __ATOMIC_RELAXED);
+    worker_notify(worker);
+    if (nworkers > 1 && sbuf_depth(&worker->queue) >= STEAL_THRESHOLD)
+        worker_notify(&workers[(worker->id + 1) % nworkers]);
+}
+
+/* Wrap a client fd taken from a queue into a connection of worker */
+static void worker_adopt(worker_t *worker, int fd) {
+    if (fd < dispatch_slots) {
+        // the queue handed fd over with release/acquire, so its stamp is visible
+        __atomic_fetch_add(&worker->wait_ms, (unsigned int) now_ms() - dispatch_ms[fd], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&worker->waited, 1, __ATOMIC_RELAXED);
+    }
+    fprintf(stdout, "proxy#runnable thread id %ld receive connect fd %d from client\n", pthread_self(), fd);
+    if (event_nonblock(fd) < 0) {
+        fprintf(stderr, "#worker_adopt cannot set fd %d non-blocking: %s\n", fd, strerror(errno));
+        Close(fd);
+        return;
+    }
+    accept_conn(worker, fd, 0);
+}
+
+int worker_steal(worker_t *worker) {
+    worker_t *victim = NULL;
+    int i, depth, max_depth = 0, n = 0, fd, active = __atomic_load_n(&nworkers, __ATOMIC_ACQUIRE);
+
+    if (worker->retiring)
+        return 0;
+    for (i = 0; i < active; i++) {
+        if (&workers[i] == worker)
+            continue;
+        if ((depth = sbuf_depth(&workers[i].queue)) > max_depth) {
+            max_depth = depth;
+            victim = &workers[i];
         }
-        if (request->hdrs != NULL) {
-            n = strlen(request->hdrs) + strlen(buf) + 1;
-            request->hdrs = (char *) Realloc(request->hdrs, n * sizeof(char *));
-            strcat(request->hdrs, head_parser(buf));
-        } else {
-            request->hdrs = Malloc(n + 1);
-            strcpy(request->hdrs, head_parser(buf));
+    }
+    if (victim == NULL)
+        return 0;
+    // leave the owner the other half, it may be just about to drain its queue
+    for (depth = (max_depth + 1) / 2; n < depth && (fd = sbuf_try_remove(&victim->queue)) >= 0; n++)
+        worker_adopt(worker, fd);
+    if (n > 0) {
+        worker->steals += n;
+        fprintf(stderr, "#worker_steal worker %d took %d fds from worker %d\n", worker->id, n, victim->id);
+    }
+    return n;
+}
+
+void notify_handler(event_handler_t *eh, unsigned int events) {
+    worker_t *worker = (worker_t *) eh->data;
+    uint64_t cnt;
+    int fd;
+
+    // reset the eventfd counter, then take every fd waiting in our queue
+    while (read(eh->fd, &cnt, sizeof(cnt)) > 0);
+    while ((fd = sbuf_try_remove(&worker->queue)) >= 0)
+        worker_adopt(worker, fd);
+    // nothing left of our own, help whoever is behind
+    worker_steal(worker);
+}
+
+void timer_handler(event_handler_t *eh, unsigned int events) {
+    worker_t *worker = (worker_t *) eh->data;
+    conn_t *conn, *next;
+    h2_session_t *session, *next_session;
+    uint64_t expirations;
+    time_t now = now_sec();
+
+    while (read(eh->fd, &expirations, sizeof(expirations)) > 0);
+    __atomic_store_n(&worker->last_tick, now_ms(), __ATOMIC_RELAXED);
+    // fds still queued a tick later belong to a worker stuck on something, report and rebalance
+    if (sbuf_depth(&worker->queue) > 0)
+        fprintf(stderr, "#timer_handler worker %d queue depth %d queued %ld steals %ld\n", worker->id,
+                sbuf_depth(&worker->queue), __atomic_load_n(&worker->queued, __ATOMIC_RELAXED), worker->steals);
+    if (worker->listen_port == 0)
+        worker_steal(worker);
+    // close client connections that sat idle (or half way through a request head or body) too long,
+    // and the ones whose response stalled: a client that stopped reading holds buffers of the loop
+    for (conn = worker->conns; conn != NULL; conn = next) {
+        next = conn->next;
+        if ((conn->state == CONN_READ_REQUEST || conn->state == CONN_SEND_BODY)
+            && now - conn->last_active >= KEEPALIVE_TIMEOUT) {
+            fprintf(stderr, "#timer_handler close idle client fd %d\n", conn->client.fd);
+            conn_close(conn);
+        } else if ((conn->state == CONN_RELAY_RESPONSE || conn->state == CONN_WRITE_RESPONSE)
+                   && now - conn->last_active >= WRITE_STALL_TIMEOUT) {
+            fprintf(stderr, "#timer_handler close stalled client fd %d\n", conn->client.fd);
+            conn_close(conn);
+        }
+    }
+    // h2c clients without open streams go the same way, told by a GOAWAY
+    for (session = worker->sessions; session != NULL; session = next_session) {
+        next_session = session->next;
+        if (session->nstreams == 0 && now - session->last_active >= KEEPALIVE_TIMEOUT) {
+            fprintf(stderr, "#timer_handler close idle h2c client fd %d\n", session->client.fd);
+            h2_session_shutdown(session);
+        }
+    }
+    // the pool is shared, one worker keeping it clean is enough (worker 0 is never retired)
+    if (worker->id == 0) {
+        int n = connpool_expire(&upstream_pool, now);
+        if (n > 0)
+            fprintf(stderr, "#timer_handler closed %d idle upstream connections\n", n);
+    }
+    if (__atomic_load_n(&worker->retiring, __ATOMIC_ACQUIRE) && worker->conns == NULL &&
+        worker->sessions == NULL && sbuf_depth(&worker->queue) == 0)
+        event_loop_stop(&worker->loop);
+}
+
+void listen_handler(event_handler_t *eh, unsigned int events) {
+    worker_t *worker = (worker_t *) eh->data;
+    int fd;
+
+    // edge triggered, take every pending connection (io_uring hands them over one per completion)
+    while (1) {
+        if ((fd = event_accept(&worker->loop, eh)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "#listen_handler accept on fd %d failed: %s\n", eh->fd, strerror(errno));
+            return;
+        }
+        fprintf(stdout, "proxy#runnable thread id %ld accept connect fd %d from client\n", pthread_self(), fd);
+        accept_conn(worker, fd, 0);
+    }
+}
+
+void accept_conn(worker_t *worker, int fd, int internal) {
+    conn_t *conn;
+
+    conn = Calloc(1, sizeof(conn_t));
+    conn->state = CONN_READ_REQUEST;
+    conn->worker = worker;
+    conn->internal = internal;
+    conn->client.fd = fd;
+    conn->client.callback = client_handler;
+    conn->client.data = conn;
+    conn->server.fd = -1;
+    conn->server.callback = server_handler;
+    conn->server.data = conn;
+    conn->pipe.rfd = conn->pipe.wfd = -1;
+    dns_query_init(&conn->dns);
+    arena_init(&conn->arena, &worker->bufs);
+    conn->content_length = -1;
+    conn->last_active = now_sec();
+    conn->next = worker->conns;
+    if (worker->conns != NULL)
+        worker->conns->prev = conn;
+    worker->conns = conn;
+
+    if (event_add_io(&worker->loop, &conn->client) < 0) {
+        fprintf(stderr, "#accept_conn event_add_io fd %d failed: %s\n", fd, strerror(errno));
+        conn_close(conn);
+        return;
+    }
+    // data may have arrived before registration, edge triggered loop won't report it
+    conn_run(conn);
+}
+
+/* give conn's response and cache buffers back to the worker's pool */
+static void conn_release_buffers(conn_t *conn) {
+    bufpool_t *bufs = &conn->worker->bufs;
+
+    bufpool_put(bufs, conn->outbuf, conn->out_cap + RESP_HDR_SLACK + 1);
+    bufpool_put(bufs, conn->cachebuf, conn->cache_cap);
+    conn->outbuf = conn->cachebuf = NULL;
+    conn->out_cap = conn->cache_cap = 0;
+}
+
+static void conn_free(void *arg) {
+    conn_t *conn = (conn_t *) arg;
+
+    bufpool_put(&conn->worker->bufs, conn->inbuf, conn->in_cap);
+    bufpool_put(&conn->worker->bufs, (char *) conn->parser, conn->parser_cap);
+    conn_release_buffers(conn);
+    arena_release(&conn->arena);
+    splicer_close(&conn->pipe);
+    // a request phase cut short by conn_close is dropped while suspended
+    if (conn->coro != NULL)
+        coro_free(conn->coro);
+    Free(conn);
+}
+
+void conn_close(conn_t *conn) {
+    if (conn->state == CONN_CLOSED)
+        return;
+    fprintf(stderr, "#conn_close close client fd %d server fd %d\n", conn->client.fd, conn->server.fd);
+    conn->state = CONN_CLOSED;
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        conn->worker->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    dnscache_cancel(&dns_cache, &conn->dns);
+    connector_cancel(&conn->connector);
+    // io_uring polls pin the file, fds are unregistered before they are closed,
+    // a client taken over by an h2 session is not ours anymore
+    if (conn->client.fd >= 0)
+        event_close(&conn->worker->loop, &conn->client);
+    if (conn->server.fd >= 0)
+        event_close(&conn->worker->loop, &conn->server);
+    // handlers of this conn may still be pending in the current batch
+    event_defer(&conn->worker->loop, conn_free, conn);
+}
+
+void conn_reset(conn_t *conn) {
+    size_t left = conn->in_len - conn->head_len;
+
+    // everything the request parsed or built lives in the arena
+    memset(&conn->request, 0, sizeof(request_t));
+    conn->sendbuf = conn->upstream = NULL;
+    conn->upstream_host = conn->upstream_port = NULL;
+    conn->send_len = conn->send_off = 0;
+    conn->req_body = 0;
+    conn->req_left = 0;
+    conn->req_ready = 0;
+    chunk_init(&conn->req_chunk);
+    conn->cache_len = conn->cache_head = 0;
+    conn->no_cache = 0;
+    conn->head_done = 0;
+    conn->keep_alive = 0;
+    conn->content_length = -1;
+    conn->chunked = conn->dechunk = conn->enchunk = 0;
+    conn->body_len = 0;
+    conn->body_done = 0;
+    chunk_init(&conn->chunk);
+    conn->server_reused = 0;
+    conn->server_close = 0;
+
+    // an idle connection holds no buffers, a pipelined next request may already sit behind the finished one
+    if (conn->pending) {
+        // answers collected for pipelined requests stay in outbuf, see conn_write_response
+        bufpool_put(&conn->worker->bufs, conn->cachebuf, conn->cache_cap);
+        conn->cachebuf = NULL;
+        conn->cache_cap = 0;
+    } else {
+        conn->out_len = conn->out_off = 0;
+        conn_release_buffers(conn);
+    }
+    if (left == 0) {
+        bufpool_put(&conn->worker->bufs, conn->inbuf, conn->in_cap);
+        conn->inbuf = NULL;
+        conn->in_cap = 0;
+        arena_release(&conn->arena);
+    } else {
+        arena_reset(&conn->arena);
+        memmove(conn->inbuf, conn->inbuf + conn->head_len, left);
+        conn->inbuf[left] = '\0';
+    }
+    conn->in_len = left;
+    conn->head_len = 0;
+    conn->last_active = now_sec();
+    conn->state = CONN_READ_REQUEST;
+    fprintf(stderr, "#conn_reset client fd %d kept alive for the next request\n", conn->client.fd);
+}
+
+/* splicer_drain to the client, a stall is only what moves nothing */
+static int conn_drain_pipe(conn_t *conn) {
+    size_t len = conn->pipe.len;
+    int ret = splicer_drain(&conn->pipe, conn->client.fd);
+
+    if (conn->pipe.len < len)
+        conn->last_active = now_sec();
+    return ret;
+}
+
+/**
+ * write conn->outbuf to the client, then whatever is spliced into conn->pipe
+ * (pipe bytes always come after the outbuf ones)
+ * @param wait whether a send io_uring still has on its way counts as not
+ *        drained, outbuf may be reused either way
+ * @return 1 when both are drained, 0 when the client would block,
+ *         -1 when the connection was closed
+ */
+static int conn_flush(conn_t *conn, int wait) {
+    event_loop_t *loop = &conn->worker->loop;
+    ssize_t n;
+    int ret;
+
+    while (conn->out_off < conn->out_len) {
+        // spliced body bytes follow right away, let them share segments with the head
+        if ((n = event_send(loop, &conn->client, conn->outbuf + conn->out_off, conn->out_len - conn->out_off,
+                            conn->pipe.len > 0 ? MSG_MORE : 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            fprintf(stderr, "#conn_flush write to client fd %d failed: %s\n", conn->client.fd, strerror(errno));
+            conn_close(conn);
+            return -1;
         }
-        fprintf(stdout, "#request_processor got request->hdrs content %s", request->hdrs);
+        conn->out_off += n;
+        conn->last_active = now_sec();
+    }
+    // on io_uring the last send may still be on its way, the fd must not be closed or handed on before it arrived
+    if (wait && (ret = event_sent(loop, &conn->client)) != 1) {
+        if (ret == 0)
+            return 0;
+        fprintf(stderr, "#conn_flush write to client fd %d failed: %s\n", conn->client.fd, strerror(errno));
+        conn_close(conn);
+        return -1;
+    }
+    if (conn->pipe.len > 0 && (ret = conn_drain_pipe(conn)) != 1) {
+        if (ret == 0)
+            return 0;
+        fprintf(stderr, "#conn_flush splice to client fd %d failed: %s\n", conn->client.fd, strerror(errno));
+        conn_close(conn);
+        return -1;
+    }
+    return 1;
+}
+
+/* give the request parser back to the worker's pool */
+static void conn_parser_put(conn_t *conn) {
+    bufpool_put(&conn->worker->bufs, (char *) conn->parser, conn->parser_cap);
+    conn->parser = NULL;
+    conn->parser_cap = 0;
+}
+
+/* answer a broken request with 400 and close, answers to earlier pipelined requests go first if they can */
+static void conn_bad_request(conn_t *conn) {
+    if (conn->pending && conn_flush(conn, 1) != 1) {
+        conn_close(conn);
+        return;
     }
+    bad_request_handler(conn->client.fd);
+    conn_close(conn);
+}
+
+/**
+ * feed the pipelined bytes behind the current request head to the parser of
+ * the next one, conn_request_main takes it over once conn_reset moved them
+ * to the start of inbuf (the parser only keeps offsets)
+ * @return REQPARSE_DONE when the next request head is complete
+ */
+static int conn_parse_ahead(conn_t *conn) {
+    if (conn->in_len == conn->head_len)
+        return REQPARSE_AGAIN;
+    if (conn->parser == NULL) {
+        conn->parser = (reqparse_t *) bufpool_get(&conn->worker->bufs, sizeof(reqparse_t), &conn->parser_cap);
+        reqparse_init(conn->parser);
+    }
+    return reqparse_feed(conn->parser, conn->inbuf + conn->head_len, conn->in_len - conn->head_len);
+}
+
+/* h2_backend_t: an h2 stream's request goes through a conn of the session's worker like any other */
+static int h2_backend_conn(h2_session_t *s, int fd) {
+    accept_conn((worker_t *) s->data, fd, 1);
     return 0;
 }
 
+/* h2_closed_t: the session leaves its worker's list */
+static void h2_session_gone(h2_session_t *s) {
+    worker_t *worker = (worker_t *) s->data;
 
-void *runnable(void *vargp) {
-    Pthread_detach(pthread_self());
-    request_t request;
-    int result;
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        worker->sessions = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+}
+
+/**
+ * hand conn's client socket over to a new h2 session, conn must be closed
+ * by the caller afterwards (it no longer owns the client). What the client
+ * sent is in inbuf then.
+ * @return the session, NULL when it could not be set up
+ */
+static h2_session_t *conn_h2_takeover(conn_t *conn) {
+    worker_t *worker = conn->worker;
+    h2_session_t *s;
+    int fd = conn->client.fd;
+    size_t n;
+
+    // bytes io_uring already took from the socket belong to the session as well
+    if ((n = event_recv_pending(&conn->client)) > 0) {
+        if (conn->in_len + n + 1 > conn->in_cap)
+            conn->inbuf = bufpool_grow(&worker->bufs, conn->inbuf, conn->in_len, &conn->in_cap, conn->in_len + n + 1);
+        conn->in_len += event_recv(&worker->loop, &conn->client, conn->inbuf + conn->in_len, n);
+        conn->inbuf[conn->in_len] = '\0';
+    }
+    event_del(&worker->loop, &conn->client);
+    conn->client.fd = -1;
+    if ((s = h2_session_create(&worker->loop, &worker->bufs, fd, h2_backend_conn, h2_session_gone, worker)) == NULL)
+        return NULL;
+    s->next = worker->sessions;
+    if (worker->sessions != NULL)
+        worker->sessions->prev = s;
+    worker->sessions = s;
+    return s;
+}
+
+/* the client opened with the HTTP/2 preface, everything it sent so far goes to the session */
+static void conn_h2_prior_knowledge(conn_t *conn) {
+    h2_session_t *s;
+
+    fprintf(stderr, "#conn_h2_prior_knowledge client fd %d speaks h2c\n", conn->client.fd);
+    if ((s = conn_h2_takeover(conn)) != NULL)
+        h2_session_start(s, conn->inbuf, conn->in_len);
+    conn_close(conn);
+}
+
+/**
+ * switch to h2c as the client asked in its request (RFC 7540 3.2), the
+ * request itself is answered on stream 1, bytes behind it are the first
+ * ones of the HTTP/2 connection
+ */
+static void conn_h2_upgrade(conn_t *conn) {
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    request_t *request = &conn->request;
+    h2_session_t *s;
+
+    fprintf(stderr, "#conn_h2_upgrade client fd %d switches to h2c\n", conn->client.fd);
+    // nothing was written to a connection that is still reading requests, the few bytes leave at once
+    if (write(conn->client.fd, switching, sizeof(switching) - 1) != sizeof(switching) - 1) {
+        conn_close(conn);
+        return;
+    }
+    if ((s = conn_h2_takeover(conn)) == NULL) {
+        conn_close(conn);
+        return;
+    }
+    if (h2_session_upgrade_settings(s, request->h2_settings, strlen(request->h2_settings)) < 0) {
+        fprintf(stderr, "#conn_h2_upgrade bad HTTP2-Settings %s\n", request->h2_settings);
+        h2_session_close(s);
+        conn_close(conn);
+        return;
+    }
+    if (h2_session_upgrade_stream(s, conn->inbuf, conn->head_len) == 0)
+        h2_session_start(s, conn->inbuf + conn->head_len, conn->in_len - conn->head_len);
+    conn_close(conn);
+}
+
+/**
+ * coro_read for conn's client: event_recv, yielding while the client has
+ * nothing more to read
+ * @return bytes read, 0 on EOF, -1 with errno set on other errors
+ */
+static ssize_t conn_coro_recv(conn_t *conn, char *buf, size_t n) {
+    ssize_t ret;
 
     while (1) {
-        int fd = sbuf_remove(&sbuffer);
-        fprintf(stdout, "proxy#runnable thread id %ld receive connect fd %d from client\n", pthread_self(), fd);
-        if ((result = request_processor(fd, &request)) == -1) {
-            bad_request_handler(fd);
-            free_request(request);
-            Close(fd);
+        if ((ret = event_recv(&conn->worker->loop, &conn->client, buf, n)) >= 0)
+            return ret;
+        if (errno == EINTR)
             continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        coro_yield();
+    }
+}
+
+/**
+ * request phase of conn, runs as a coroutine: read the rest of the request
+ * head, parse it and forward it. conn_coro_recv yields whenever the client has
+ * nothing more to read, client_handler resumes us through conn_read_request.
+ * @param arg conn_t whose client already sent the first bytes of a request
+ */
+static void conn_request_main(void *arg) {
+    conn_t *conn = (conn_t *) arg;
+    reqparse_t *parser;
+    ssize_t n;
+    int rc;
+
+    // the parser keeps its place between reads, every byte is looked at once, a pipelined head
+    // may already have been parsed by conn_parse_ahead
+    if (conn->parser == NULL) {
+        conn->parser = (reqparse_t *) bufpool_get(&conn->worker->bufs, sizeof(reqparse_t), &conn->parser_cap);
+        reqparse_init(conn->parser);
+    }
+    parser = conn->parser;
+    rc = reqparse_feed(parser, conn->inbuf, conn->in_len);
+    while (rc == REQPARSE_AGAIN && conn->in_len < REQUEST_HEAD_MAX - 1) {
+        // most heads fit the first buffer, long ones double it up to REQUEST_HEAD_MAX
+        if (conn->in_len == conn->in_cap - 1)
+            conn->inbuf = bufpool_grow(&conn->worker->bufs, conn->inbuf, conn->in_len, &conn->in_cap,
+                                       conn->in_cap * 2 < REQUEST_HEAD_MAX ? conn->in_cap * 2 : REQUEST_HEAD_MAX);
+        if ((n = conn_coro_recv(conn, conn->inbuf + conn->in_len, conn->in_cap - 1 - conn->in_len)) <= 0) {
+            // client closed or failed before sending a whole request
+            conn_close(conn);
+            return;
         }
-        // request_processor process request ok then forward the request to server here
-        fprintf(stderr, "#runnable==> begin execute forward_request with request#hdrs %s "
-                        "request#domain %s request#path %s request#pathbuf %s \n\n",
-                request.hdrs, request.domain, request.path, request.pathbuf);
-        forward_request(fd, request);
-        fprintf(stderr, "#runnable==> forward finish sleep for 10 seconds and close connection to client\n");
-        sleep(10);
-        Close(fd);
+        conn->in_len += n;
+        conn->last_active = now_sec();
+        conn->inbuf[conn->in_len] = '\0';
+        rc = reqparse_feed(parser, conn->inbuf, conn->in_len);
+    }
+
+    if (rc == REQPARSE_AGAIN) {
+        fprintf(stderr, "#conn_request_main request head of fd %d exceeds %d bytes\n", conn->client.fd,
+                REQUEST_HEAD_MAX);
+        conn_bad_request(conn);
+        return;
+    }
+    conn->head_len = parser->head_len;
+    if (rc == REQPARSE_ERROR || request_processor(conn->inbuf, parser, &conn->request, &conn->arena) == -1) {
+        conn_bad_request(conn);
+        return;
+    }
+    // only requests without a body are upgraded, a client must send exactly one HTTP2-Settings with it
+    if (h2c_mode && !conn->internal && conn->request.upgrade_h2c && conn->request.h2_settings != NULL
+        && parser->method.len == 3 && memcmp(conn->inbuf + parser->method.off, "GET", 3) == 0) {
+        conn_parser_put(conn);
+        conn_h2_upgrade(conn);
+        return;
     }
+    // request_processor copied what it needs, the parser is free until the next head
+    conn_parser_put(conn);
+    // request_processor process request ok then forward the request to server here
+    fprintf(stderr, "#conn_request_main==> begin execute forward_request with request#hdrs %s "
+                    "request#domain %s request#path %s request#pathbuf %s \n\n",
+            conn->request.hdrs, conn->request.domain, conn->request.path, conn->request.pathbuf);
+    forward_request(conn);
 }
 
+/**
+ * CONN_READ_REQUEST: wait for the client's next request and run its request
+ * phase as a coroutine. The coroutine is only created once bytes arrived, so
+ * idle keep-alive connections don't hold a stack.
+ */
+static int conn_read_request(conn_t *conn) {
+    ssize_t n;
+
+    if (conn->coro == NULL) {
+        if (conn->in_len == 0) {
+            if (conn->inbuf == NULL)
+                conn->inbuf = bufpool_get(&conn->worker->bufs, 1, &conn->in_cap);
+            if ((n = event_recv(&conn->worker->loop, &conn->client, conn->inbuf, conn->in_cap - 1)) <= 0) {
+                if (n < 0 && errno == EINTR)
+                    return 1;
+                // nothing to read yet, the buffer goes back until the client sends something
+                bufpool_put(&conn->worker->bufs, conn->inbuf, conn->in_cap);
+                conn->inbuf = NULL;
+                conn->in_cap = 0;
+                // EOF: client closed between two requests
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    conn_close(conn);
+                return 0;
+            }
+            conn->in_len = n;
+            conn->last_active = now_sec();
+            conn->inbuf[n] = '\0';
+            // an h2c client with prior knowledge opens with the HTTP/2 preface instead of a request line
+            if (h2c_mode && !conn->internal && h2_is_preface(conn->inbuf, conn->in_len)) {
+                conn_h2_prior_knowledge(conn);
+                return 0;
+            }
+        }
+        conn->coro = coro_create(&conn->worker->sched, conn_request_main, conn);
+    }
+    coro_resume(conn->coro);
+    if (!conn->coro->done)
+        return 0;
+    coro_free(conn->coro);
+    conn->coro = NULL;
+    return conn->state != CONN_CLOSED;
+}
 
-void free_request(request_t request) {
-    Free(request.domain);
-    Free(request.hdrs);
-    Free(request.path);
-    Free(request.pathbuf);
+/* server socket fd is connected, register it and start sending the request */
+static int conn_server_ready(conn_t *conn, int fd) {
+    conn->server.fd = fd;
+    if (event_nonblock(fd) < 0 || event_add_io(&conn->worker->loop, &conn->server) < 0) {
+        fprintf(stderr, "#conn_server_ready cannot register server fd %d: %s\n", fd, strerror(errno));
+        return -1;
+    }
+    conn->state = CONN_SEND_REQUEST;
+    return 0;
 }
 
-void not_found_handler(int fd) {
-    fprintf(stdout, "#not_found_handler process fd %d", fd);
-    Rio_writen(fd, "<html>\r\n", 8);
-    Rio_writen(fd, "<body>\r\n", 8);
-    Rio_writen(fd, "404: not found", 14);
-    Rio_writen(fd, "</body>\r\n", 9);
-    Rio_writen(fd, "</html>\r\n", 9);
+/* connector callback, the race for conn's upstream is decided */
+static void connector_handler(connector_t *c, int fd) {
+    conn_t *conn = (conn_t *) c->data;
+
+    if (fd < 0) {
+        fprintf(stderr, "#connector_handler cannot connect to remote server %s: %s\n", conn->upstream,
+                strerror(c->error));
+        conn_close(conn);
+        return;
+    }
+    fprintf(stderr, "#connector_handler proxy connected to server %s fd %d\n", conn->upstream, fd);
+    if (conn_server_ready(conn, fd) < 0) {
+        conn_close(conn);
+        return;
+    }
+    conn_run(conn);
 }
 
-void bad_request_handler(int fd) {
-    fprintf(stdout, "#bad_request_handler process fd %d return 404 message", fd);
-    Rio_writen(fd, "<html>\r\n", 8);
-    Rio_writen(fd, "<body>\r\n", 8);
-    Rio_writen(fd, "400: bad request", 16);
-    Rio_writen(fd, "</body>\r\n", 9);
-    Rio_writen(fd, "</html>\r\n", 9);
-}
-
-char *head_parser(char *buf) {
-    char *cp, *head;
-    size_t size;
-    size = strlen(buf) > strlen(user_agent_hdr) ? strlen(buf) : strlen(user_agent_hdr);
-    cp = (char *) Malloc(size + 1);
-    head = (char *) Malloc(51);
-    strcpy(cp, buf);
-
-    strcpy(head, strtok(buf, ":"));
-    if (strcmp(head, "User-Agent") == 0)
-        strcpy(cp, user_agent_hdr);
-    if (strcmp(head, "Accept") == 0)
-        strcpy(cp, accept_hdr);
-    if (strcmp(head, "Accept-Encoding") == 0)
-        strcpy(cp, accept_encoding_hdr);
-    if (strcmp(head, "Connection") == 0)
-        strcpy(cp, conn_hdr);
-    if (strcmp(head, "Proxy-Connection") == 0)
-        strcpy(cp, prox_hdr);
-
-    strcpy(buf, cp);
-    Free(head);
-    Free(cp);
-    return buf;
-}
-
-int parse_req(char *buf, request_t *request) {
-    char *save, *p;
-
-    request->pathbuf = Malloc(strlen(buf) + 1);
-    strcpy(request->pathbuf, buf);
-    strtok_r(buf, " ", &save);    // GET
-    strtok_r(NULL, "//", &save);  // http
-    p = strtok_r(NULL, "/", &save); // domain
-    if (p) {
-        request->domain = Malloc(strlen(p) + 1);
-    } else {
+/**
+ * the server's addresses are in conn->dns, race them with the connector
+ * @return 0 when connecting, -1 when there is nothing to connect to
+ */
+static int conn_connect_server(conn_t *conn) {
+    if (conn->dns.error != 0 || conn->dns.naddrs == 0) {
+        fprintf(stderr, "#conn_connect_server cannot resolve remote server %s: %s\n", conn->upstream,
+                conn->dns.error != 0 ? gai_strerror(conn->dns.error) : "no address");
+        return -1;
+    }
+    conn->state = CONN_CONNECT;
+    conn->connector.callback = connector_handler;
+    conn->connector.data = conn;
+    // the connector reports failures of every address through connector_handler
+    return connector_start(&conn->connector, &conn->worker->loop, conn->dns.addrs, conn->dns.naddrs,
+                           atoi(conn->upstream_port), connect_timeout);
+}
+
+/* dns_cache callback, a resolver thread looked the server up for conn */
+static void dns_handler(dns_query_t *q) {
+    conn_t *conn = (conn_t *) q->data;
+
+    if (conn_connect_server(conn) < 0)
+        conn_close(conn);
+}
+
+/**
+ * connect conn to its upstream, reusing an idle pooled connection when allowed,
+ * otherwise the server is looked up in dns_cache (CONN_RESOLVE on a miss) and
+ * a connector is started (CONN_CONNECT)
+ * @param conn connection with upstream, upstream_host, upstream_port and sendbuf set
+ * @param reuse whether upstream_pool may be asked first
+ * @return 0 on success, -1 when no server connection could be set up
+ */
+static int conn_open_server(conn_t *conn, int reuse) {
+    int server, ret;
+
+    conn->server_reused = 0;
+    if (reuse && (server = connpool_get(&upstream_pool, conn->upstream)) >= 0) {
+        conn->server_reused = 1;
+        fprintf(stderr, "#conn_open_server reuse pooled connection fd %d to %s\n", server, conn->upstream);
+        return conn_server_ready(conn, server);
+    }
+    conn->state = CONN_RESOLVE;
+    conn->dns.callback = dns_handler;
+    conn->dns.data = conn;
+    if ((ret = dnscache_resolve(&dns_cache, &conn->dns, &conn->worker->loop, conn->upstream_host)) < 0) {
+        fprintf(stderr, "#conn_open_server cannot look up %s: %s\n", conn->upstream_host, strerror(errno));
         return -1;
     }
-    strcpy(request->domain, p);
-    p = strtok_r(NULL, " ", &save);  // path
-    if (strcmp(p, "HTTP/1.1\r\n") == 0 || strcmp(p, "favicon.ico") == 0) {
-        strtok_r(buf, "//", &save);
-        p = strtok_r(NULL, " ", &save);
-        if (p) {
-            request->path = Malloc(strlen(p) + 1);
+    // a known host is answered right away, otherwise dns_handler carries on
+    return ret == 1 ? conn_connect_server(conn) : 0;
+}
+
+/**
+ * a pooled server connection may have been closed by the server right before
+ * we reused it, in that case send the request once more on a fresh connection
+ * @return 1 when the failure was handled (request resent or conn closed),
+ *         0 when it has to be treated as a real server failure
+ */
+static int conn_retry_server(conn_t *conn) {
+    // outbuf bytes that are no answers to earlier pipelined requests came from the server
+    if (!conn->server_reused || conn->head_done || (conn->out_len > 0 && !conn->pending))
+        return 0;
+    fprintf(stderr, "#conn_retry_server pooled connection fd %d to %s went stale, reconnect\n",
+            conn->server.fd, conn->upstream);
+    event_close(&conn->worker->loop, &conn->server);
+    conn->send_off = 0;
+    if (conn_open_server(conn, 0) < 0)
+        conn_close(conn);
+    return 1;
+}
+
+/* make outbuf hold at least n response bytes (plus the slack), its out_len bytes are kept */
+static void conn_outbuf_reserve(conn_t *conn, size_t n) {
+    size_t cap = conn->out_cap + RESP_HDR_SLACK + 1;
+
+    if (conn->outbuf != NULL && conn->out_cap >= n)
+        return;
+    conn->outbuf = bufpool_grow(&conn->worker->bufs, conn->outbuf, conn->out_len, &cap, n + RESP_HDR_SLACK + 1);
+    conn->out_cap = cap - RESP_HDR_SLACK - 1;
+}
+
+/* CONN_SEND_REQUEST: write the rebuilt request head to the server */
+static int conn_send_request(conn_t *conn) {
+    ssize_t n;
+
+    while (conn->send_off < conn->send_len) {
+        if ((n = event_send(&conn->worker->loop, &conn->server, conn->sendbuf + conn->send_off,
+                            conn->send_len - conn->send_off, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            fprintf(stderr, "#conn_send_request write to server fd %d failed: %s\n", conn->server.fd, strerror(errno));
+            if (conn_retry_server(conn))
+                return conn->state != CONN_CLOSED;
+            conn_close(conn);
+            return 0;
+        }
+        conn->send_off += n;
+    }
+    fprintf(stderr, "#conn_send_request sent to server content %s\n", conn->sendbuf);
+    if (!conn->req_body) {
+        conn->last_active = now_sec();
+        conn->state = CONN_RELAY_RESPONSE;
+        return 1;
+    }
+    // the server is there to take the body, a client waiting for 100 Continue gets it behind earlier answers
+    if (conn->request.expect_continue && conn->request.http11) {
+        conn_outbuf_reserve(conn, conn->out_len + sizeof(continue_resp) - 1);
+        memcpy(conn->outbuf + conn->out_len, continue_resp, sizeof(continue_resp) - 1);
+        conn->out_len += sizeof(continue_resp) - 1;
+        conn->pending = 1;
+    }
+    conn->state = CONN_SEND_BODY;
+    return 1;
+}
+
+/* io_uring reads land in the loop's provided buffers, bodies are copied from there instead of spliced */
+static int conn_splice_ok(conn_t *conn) {
+    return conn->worker->loop.backend != EVENT_BACKEND_URING;
+}
+
+/**
+ * CONN_SEND_BODY: stream the request body from the client to the server,
+ * never more than one inbuf of it is held. Body bytes already in inbuf
+ * behind the head and chunk size lines are written from there, chunk data
+ * and Content-Length bodies are spliced from the client socket to the
+ * server socket through conn->pipe (on io_uring they go through inbuf too).
+ * Bytes behind the body stay in inbuf for the next pipelined request.
+ */
+static int conn_send_body(conn_t *conn) {
+    ssize_t n;
+    size_t max;
+    int ret;
+
+    // nothing of the body is in the pipe while the client hasn't been told to send it
+    if (conn->pending && conn->pipe.len == 0) {
+        if ((ret = conn_flush(conn, 0)) < 0)
+            return 0;
+        if (ret == 1) {
+            conn->out_off = conn->out_len = 0;
+            conn->pending = 0;
+        }
+    }
+    for (;;) {
+        // spliced bytes are older than those in inbuf, they leave first
+        if (conn->pipe.len > 0 && (ret = splicer_drain(&conn->pipe, conn->server.fd)) != 1) {
+            if (ret == 0)
+                return 0;
+            fprintf(stderr, "#conn_send_body splice to server fd %d failed: %s\n", conn->server.fd, strerror(errno));
+            conn_close(conn);
+            return 0;
+        }
+        while (conn->req_ready > 0) {
+            if ((n = event_send(&conn->worker->loop, &conn->server, conn->inbuf + conn->head_len, conn->req_ready,
+                                0)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return 0;
+                fprintf(stderr, "#conn_send_body write to server fd %d failed: %s\n", conn->server.fd,
+                        strerror(errno));
+                conn_close(conn);
+                return 0;
+            }
+            conn->head_len += n;
+            conn->req_ready -= n;
+        }
+        if (conn->request.chunked ? conn->req_chunk.done : conn->req_left == 0)
+            break;
+        if (conn->in_len > conn->head_len) {
+            // bytes that came along with the head or a size line, only those up to the end of the body are ours
+            n = conn->in_len - conn->head_len;
+            if (conn->request.chunked) {
+                conn->req_ready = chunk_decode(&conn->req_chunk, conn->inbuf + conn->head_len, n, NULL, NULL);
+                if (conn->req_chunk.state == CHUNK_ERROR) {
+                    fprintf(stderr, "#conn_send_body broken chunk framing from client fd %d\n", conn->client.fd);
+                    conn_close(conn);
+                    return 0;
+                }
+            } else {
+                conn->req_ready = (size_t) n < (size_t) conn->req_left ? (size_t) n : (size_t) conn->req_left;
+                conn->req_left -= conn->req_ready;
+            }
+            continue;
+        }
+        // inbuf is drained, the next bytes go to its start
+        conn->in_len = conn->head_len = 0;
+        if (conn_splice_ok(conn)
+            && (!conn->request.chunked || (conn->req_chunk.state == CHUNK_DATA && conn->req_chunk.left > 0))) {
+            max = conn->request.chunked ? conn->req_chunk.left : (size_t) conn->req_left;
+            if (conn->pipe.rfd < 0 && splicer_open(&conn->pipe) < 0)
+                n = -1;
+            else
+                n = splicer_fill(&conn->pipe, conn->client.fd, max);
+            if (n > 0) {
+                if (conn->request.chunked)
+                    chunk_skip(&conn->req_chunk, n);
+                else
+                    conn->req_left -= n;
+            }
         } else {
-            return -1;
+            // size lines and trailers are looked at in inbuf
+            n = event_recv(&conn->worker->loop, &conn->client, conn->inbuf, conn->in_cap - 1);
+            if (n > 0) {
+                conn->in_len = n;
+                conn->inbuf[n] = '\0';
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            fprintf(stderr, "#conn_send_body read from client fd %d failed: %s\n", conn->client.fd, strerror(errno));
+            conn_close(conn);
+            return 0;
+        }
+        if (n == 0) {
+            fprintf(stderr, "#conn_send_body client fd %d closed inside the request body\n", conn->client.fd);
+            conn_close(conn);
+            return 0;
         }
-        strcpy(request->path, p);
-        request->domain = Realloc(request->domain, strlen("local") + 1);
-        strcpy(request->domain, "local");
+        conn->last_active = now_sec();
+    }
+    fprintf(stderr, "#conn_send_body request body sent to server fd %d\n", conn->server.fd);
+    conn->state = CONN_RELAY_RESPONSE;
+    return 1;
+}
+
+/**
+ * insert one of our header lines in front of the empty line ending the head,
+ * buf needs RESP_HDR_SLACK spare bytes behind len
+ * @return new length of buf
+ */
+static size_t response_head_insert(char *buf, size_t head_len, size_t len, const char *hdr) {
+    size_t n = strlen(hdr);
+
+    memmove(buf + head_len - 2 + n, buf + head_len - 2, len - (head_len - 2));
+    memcpy(buf + head_len - 2, hdr, n);
+    return len + n;
+}
+
+/* make room for n more bytes in cachebuf, gives up on the object once it turns out too big for the cache */
+static int conn_cache_reserve(conn_t *conn, size_t n) {
+    size_t want;
+
+    if (conn->no_cache)
         return 0;
+    if (conn->cache_len + n >= MAX_OBJECT_SIZE) {
+        conn->no_cache = 1;
+        return 0;
+    }
+    if (conn->cache_len + n + 1 > conn->cache_cap) {
+        want = conn->cache_len + n + 1 > CACHEBUF_MIN ? conn->cache_len + n + 1 : CACHEBUF_MIN;
+        conn->cachebuf = bufpool_grow(&conn->worker->bufs, conn->cachebuf, conn->cache_len, &conn->cache_cap, want);
     }
+    return 1;
+}
+
+/* append response bytes to cachebuf until the object turns out too big for the cache */
+static void conn_cache_append(conn_t *conn, const char *buf, size_t n) {
+    if (!conn_cache_reserve(conn, n))
+        return;
+    memcpy(conn->cachebuf + conn->cache_len, buf, n);
+    conn->cache_len += n;
+    conn->cachebuf[conn->cache_len] = '\0';
+}
+
+/**
+ * the cache keeps objects delimited by Content-Length whatever the server
+ * sent, so a hit can be served to any client on a kept connection: add the
+ * length to a head that had chunk framing or none at all
+ * @return 0 when the object no longer fits the cache
+ */
+static int conn_cache_length(conn_t *conn) {
+    char hdr[64];
+    size_t n;
+
+    if (conn->content_length >= 0)
+        return 1;
+    n = sprintf(hdr, "Content-Length: %zu\r\n", conn->cache_len - conn->cache_head);
+    if (!conn_cache_reserve(conn, n))
+        return 0;
+    conn->cache_len = response_head_insert(conn->cachebuf, conn->cache_head, conn->cache_len, hdr);
+    conn->cachebuf[conn->cache_len] = '\0';
+    return 1;
+}
 
-    if (p) {
-        request->path = Malloc(strlen(p) + 1);
+/**
+ * take the next n body bytes of the response in buf: account them, copy the
+ * object to cachebuf (chunk data only, the cache keeps no framing) and drop
+ * the chunk framing in place for a client that can't take it. Bytes beyond
+ * the end of the body are never passed on.
+ * @return number of bytes left in buf for the client
+ */
+static size_t conn_body(conn_t *conn, char *buf, size_t n) {
+    size_t m, data;
+
+    if (conn->chunked) {
+        if (conn->dechunk) {
+            m = chunk_decode(&conn->chunk, buf, n, buf, &data);
+            conn_cache_append(conn, buf, data);
+        } else if (conn_cache_reserve(conn, n)) {
+            // one pass follows the framing for the client and decodes the object for the cache
+            m = chunk_decode(&conn->chunk, buf, n, conn->cachebuf + conn->cache_len, &data);
+            conn->cache_len += data;
+            conn->cachebuf[conn->cache_len] = '\0';
+            data = m;
+        } else {
+            data = m = chunk_decode(&conn->chunk, buf, n, NULL, NULL);
+        }
+        conn->body_done = conn->chunk.done;
     } else {
+        m = n;
+        if (conn->content_length >= 0) {
+            if (m > (size_t) conn->content_length - conn->body_len)
+                m = conn->content_length - conn->body_len;
+            if (conn->body_len + m == (size_t) conn->content_length)
+                conn->body_done = 1;
+        }
+        conn_cache_append(conn, buf, m);
+        data = m;
+    }
+    if (m < n)
+        conn->server_close = 1;   // server sent more than the response, don't trust its connection
+    conn->body_len += m;
+    return data;
+}
+
+/**
+ * a body that is not going to be cached (too big for MAX_OBJECT_SIZE) is moved
+ * with splice(), as long as no chunk framing has to be looked at
+ */
+static int conn_can_splice(conn_t *conn) {
+    if (!conn->no_cache || conn->enchunk || conn->pipe.len > 0 || !conn_splice_ok(conn))
+        return 0;
+    if (conn->chunked)
+        return conn->chunk.state == CHUNK_DATA && conn->chunk.left > 0;
+    return 1;
+}
+
+/**
+ * splice the next piece of the body from the server into conn->pipe
+ * @return bytes moved, 0 on EOF, -1 with errno set
+ */
+static ssize_t conn_splice_body(conn_t *conn) {
+    size_t max = SPLICER_CHUNK;
+    ssize_t n;
+
+    if (conn->pipe.rfd < 0 && splicer_open(&conn->pipe) < 0)
         return -1;
+    if (conn->chunked && conn->chunk.left < max)
+        max = conn->chunk.left;
+    else if (!conn->chunked && conn->content_length >= 0 && (size_t) conn->content_length - conn->body_len < max)
+        max = conn->content_length - conn->body_len;
+    if ((n = splicer_fill(&conn->pipe, conn->server.fd, max)) <= 0)
+        return n;
+    conn->last_active = now_sec();
+    conn->body_len += n;
+    if (conn->chunked)
+        chunk_skip(&conn->chunk, n);
+    else if (conn->content_length >= 0 && conn->body_len == (size_t) conn->content_length)
+        conn->body_done = 1;
+    return n;
+}
+
+/**
+ * feed the response bytes in outbuf to conn->resp, once the head is complete:
+ * decide whether the object goes to the cache before any body byte is
+ * handled and how the body is framed for the client, strip hop-by-hop
+ * headers, decide whether the client connection can be kept and announce
+ * it in the head. Interim 1xx heads in front of it are dropped.
+ * @return 1 when the head was handled, 0 when more bytes are needed
+ */
+static int conn_response_head(conn_t *conn) {
+    respparse_t *resp = &conn->resp;
+    size_t stripped_len, head_len, body_n, m;
+    int rc;
+
+    while ((rc = respparse_feed(resp, conn->outbuf, conn->out_len)) == RESPPARSE_DONE && resp->status < 200) {
+        // interim answers (100 Continue, 103 Early Hints ...) are not passed on, only the final head
+        // decides framing and pooling
+        fprintf(stderr, "#conn_response_head drop interim status %d from fd %d\n", resp->status, conn->server.fd);
+        conn->out_len -= resp->head_len;
+        memmove(conn->outbuf, conn->outbuf + resp->head_len, conn->out_len);
+        respparse_init(resp);
     }
-    strcpy(request->path, p);
-    return 0;
+    if (rc != RESPPARSE_DONE) {
+        if (rc == RESPPARSE_AGAIN && conn->out_len < conn->out_cap)
+            return 0;
+        // no sane head within one buffer, relay it untouched and close afterwards
+        fprintf(stderr, "#conn_response_head no response head in %zu bytes from fd %d\n", conn->out_len,
+                conn->server.fd);
+        conn->no_cache = 1;
+        conn->head_done = 1;
+        conn->keep_alive = 0;
+        conn->server_close = 1;
+        return 1;
+    }
+
+    conn->content_length = resp->content_length;
+    conn->chunked = resp->chunked;
+    conn->server_close = resp->server_close;
+    // the answer to HEAD ends with its head, whatever framing it announces
+    if (strcmp(conn->request.method, "HEAD") == 0) {
+        conn->content_length = 0;
+        conn->chunked = 0;
+    }
+    // decided up front: an object that won't be cached is never copied and its body can be spliced from the first byte
+    if (conn->request.no_cache || resp->no_cache != NULL
+        || (conn->content_length >= 0 && resp->head_len + (size_t) conn->content_length >= MAX_OBJECT_SIZE)) {
+        fprintf(stderr, "#conn_response_head status %d from fd %d not cached (%s)\n", resp->status, conn->server.fd,
+                conn->request.no_cache ? "request" : resp->no_cache != NULL ? resp->no_cache : "size");
+        conn->no_cache = 1;
+    }
+    // the head goes on with our own version (same length, "HTTP/1.x" is checked by respparse), clients would
+    // otherwise fall back to HTTP/1.0 for their next requests after an old origin answered
+    conn->outbuf[7] = '1';
+    // HTTP/1.0 clients can't take chunks, HTTP/1.1 ones get them instead of a body ended by closing
+    conn->dechunk = conn->chunked && !conn->request.http11;
+    conn->enchunk = !conn->chunked && conn->content_length < 0 && conn->request.http11;
+    if (conn_cache_reserve(conn, resp->head_len)) {
+        // the cached head loses its chunk framing, conn_cache_length gives it a length once the body is complete
+        memcpy(conn->cachebuf, conn->outbuf, resp->head_len);
+        conn->cache_len = conn->cache_head = respparse_strip(resp, conn->cachebuf, resp->head_len,
+                                                             conn->chunked ? RESPPARSE_STRIP_TE : 0);
+        conn->cachebuf[conn->cache_len] = '\0';
+    }
+    body_n = conn->out_len - resp->head_len;
+    stripped_len = respparse_strip(resp, conn->outbuf, conn->out_len, conn->dechunk ? RESPPARSE_STRIP_TE : 0);
+    m = conn_body(conn, conn->outbuf + stripped_len, body_n);
+    conn->out_len = stripped_len + m;
+
+    // the client can only find the end of the body by Content-Length or chunk framing
+    conn->keep_alive = conn->request.keep_alive
+                       && (conn->content_length >= 0 || (conn->chunked && !conn->dechunk) || conn->enchunk);
+    conn->out_len = response_head_insert(conn->outbuf, stripped_len, conn->out_len,
+                                         conn->keep_alive ? keep_alive_resp_hdr : close_resp_hdr);
+    if (conn->enchunk) {
+        conn->out_len = response_head_insert(conn->outbuf, stripped_len, conn->out_len, chunked_resp_hdr);
+        head_len = conn->out_len - m;
+        if (m > 0)
+            conn->out_len = head_len + chunk_encode(conn->outbuf + head_len, m);
+    }
+    conn->out_off = 0;
+    conn->head_done = 1;
+    return 1;
+}
+
+/* CONN_RELAY_RESPONSE: copy server bytes to client, one outbuf at a time */
+static int conn_relay_response(conn_t *conn) {
+    char line[CHUNK_HEAD_MAX];
+    ssize_t n;
+    size_t m, h, want, off;
+
+    while (!conn->body_done) {
+        if (conn->pending) {
+            // answers to earlier pipelined requests leave first, our request went to the server meanwhile
+            if (conn_flush(conn, 0) != 1)
+                return 0;
+            conn->out_off = conn->out_len = 0;
+            conn->pending = 0;
+        }
+        if (conn->head_done) {
+            // a head followed by a spliced body: fill the pipe first so both go out together
+            if (conn->out_off < conn->out_len && conn_can_splice(conn) && conn_splice_body(conn) < 0
+                && errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "#conn_relay_response splice from server fd %d failed: %s\n", conn->server.fd,
+                        strerror(errno));
+                conn_close(conn);
+                return 0;
+            }
+            // only read more from server once the client took the previous chunk, on io_uring the
+            // next read overlaps the send of this one
+            if (conn_flush(conn, 0) != 1)
+                return 0;
+            conn->out_off = conn->out_len = 0;
+        }
+        if (conn->head_done && conn_can_splice(conn)) {
+            // zero-copy: server socket -> pipe -> client socket, flushed by the next conn_flush
+            if ((n = conn_splice_body(conn)) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return 0;
+                fprintf(stderr, "#conn_relay_response splice from server fd %d failed: %s\n", conn->server.fd,
+                        strerror(errno));
+                conn_close(conn);
+                return 0;
+            }
+            if (n == 0) {
+                conn->server_close = 1;
+                break;
+            }
+            continue;
+        }
+        // small responses fit the first outbuf, bodies that keep coming get RELAY_BUFSIZE reads
+        if (conn->head_done && conn->out_len == 0 && conn->out_cap < RELAY_BUFSIZE - RESP_HDR_SLACK - 1
+            && (conn->chunked || conn->content_length < 0
+                || (size_t) conn->content_length - conn->body_len > conn->out_cap))
+            conn_outbuf_reserve(conn, RELAY_BUFSIZE - RESP_HDR_SLACK - 1);
+        // never ask for more than the rest of a Content-Length body
+        want = conn->out_cap - conn->out_len;
+        if (conn->head_done && !conn->chunked && conn->content_length >= 0
+            && (size_t) conn->content_length - conn->body_len < want)
+            want = conn->content_length - conn->body_len;
+        // a body framed as chunks by us is read behind the room for its size line
+        off = conn->head_done && conn->enchunk ? CHUNK_HEAD_MAX : 0;
+        if (off > 0)
+            want -= off + CHUNK_TAIL_LEN;
+        if ((n = event_recv(&conn->worker->loop, &conn->server, conn->outbuf + conn->out_len + off, want)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            fprintf(stderr, "#conn_relay_response read from server fd %d failed: %s\n", conn->server.fd, strerror(errno));
+            if (conn_retry_server(conn))
+                return conn->state != CONN_CLOSED;
+            conn_close(conn);
+            return 0;
+        }
+        if (n == 0) {
+            if (conn_retry_server(conn))
+                return conn->state != CONN_CLOSED;
+            if (!conn->head_done) {
+                // server closed inside the head, pass on what we got, it is no object for the cache
+                conn->no_cache = 1;
+                conn->head_done = 1;
+            } else if (conn->enchunk) {
+                // the close ends the body, the client learns it from the last chunk
+                memcpy(conn->outbuf + conn->out_len, CHUNK_LAST, CHUNK_LAST_LEN);
+                conn->out_len += CHUNK_LAST_LEN;
+                conn->body_done = 1;
+            }
+            conn->server_close = 1;
+            break;
+        }
+        fprintf(stderr, "#conn_relay_response read data from server n %zd fd %d\n", n, conn->server.fd);
+        conn->last_active = now_sec();
+        if (!conn->head_done) {
+            // the parser goes on from where the last read left it
+            conn->out_len += n;
+            conn_response_head(conn);
+            continue;
+        }
+        m = conn_body(conn, conn->outbuf + off, n);
+        if (off > 0) {
+            h = chunk_head(line, m);
+            memcpy(conn->outbuf + off - h, line, h);
+            memcpy(conn->outbuf + off + m, CHUNK_TAIL, CHUNK_TAIL_LEN);
+            conn->out_off = off - h;
+            conn->out_len = off + m + CHUNK_TAIL_LEN;
+        } else {
+            conn->out_len = m;
+        }
+    }
+
+    if (conn->chunk.state == CHUNK_ERROR) {
+        // framing announced to the client is broken, only closing ends the body
+        conn->keep_alive = 0;
+        conn->server_close = 1;
+    } else if (!conn->body_done && (conn->content_length >= 0 || conn->chunked)) {
+        // server closed early, the client would wait for the missing bytes forever
+        conn->keep_alive = 0;
+    } else if (!conn->no_cache && conn->cache_len > 0 && conn_cache_length(conn)
+               && memchr(conn->cachebuf, '\0', conn->cache_len) == NULL) {
+        // here we cache accumulated webobject, the cache keeps C strings so binary objects are skipped
+        P(&w);
+        int cache_ret = set(conn->request.path, conn->cachebuf);
+        V(&w);
+        fprintf(stderr, "#conn_relay_response here we sync data from cachebuf to cache sync result %d\n", cache_ret);
+    }
+    if (conn->body_done && !conn->server_close && event_recv_pending(&conn->server) == 0) {
+        // response fully framed, the server connection can serve the next miss to the same origin,
+        // unless io_uring already read bytes beyond the response from it
+        event_del(&conn->worker->loop, &conn->server);
+        fprintf(stderr, "#conn_relay_response return server fd %d to pool %s\n", conn->server.fd, conn->upstream);
+        connpool_put(&upstream_pool, conn->upstream, conn->server.fd);
+        conn->server.fd = -1;
+    } else {
+        event_close(&conn->worker->loop, &conn->server);
+    }
+    conn->state = CONN_WRITE_RESPONSE;
+    return 1;
+}
+
+/**
+ * CONN_WRITE_RESPONSE: flush what is left, then wait for the next request or
+ * close. When the next pipelined request is already complete in inbuf it is
+ * handled first and its answer joins this one in outbuf, so a run of cache
+ * hits leaves in order with one write.
+ */
+static int conn_write_response(conn_t *conn) {
+    if (conn->keep_alive && conn->pipe.len == 0 && conn->out_len - conn->out_off < PIPELINE_BATCH_MAX
+        && conn_parse_ahead(conn) == REQPARSE_DONE) {
+        fprintf(stderr, "#conn_write_response next request of fd %d already here, %zu bytes held back\n",
+                conn->client.fd, conn->out_len - conn->out_off);
+        conn->pending = 1;
+        conn_reset(conn);
+        return 1;
+    }
+    if (conn_flush(conn, 1) != 1)
+        return 0;
+    conn->pending = 0;
+    if (!conn->keep_alive) {
+        conn_close(conn);
+        return 0;
+    }
+    conn_reset(conn);
+    return 1;
+}
+
+void conn_run(conn_t *conn) {
+    int progress = 1;
+
+    while (progress) {
+        switch (conn->state) {
+            case CONN_READ_REQUEST:
+                progress = conn_read_request(conn);
+                break;
+            case CONN_RESOLVE:
+            case CONN_CONNECT:
+                // dns_handler / connector_handler resume the connection
+                progress = 0;
+                break;
+            case CONN_SEND_REQUEST:
+                progress = conn_send_request(conn);
+                break;
+            case CONN_SEND_BODY:
+                progress = conn_send_body(conn);
+                break;
+            case CONN_RELAY_RESPONSE:
+                progress = conn_relay_response(conn);
+                break;
+            case CONN_WRITE_RESPONSE:
+                progress = conn_write_response(conn);
+                break;
+            default:
+                progress = 0;
+                break;
+        }
+    }
+}
+
+void client_handler(event_handler_t *eh, unsigned int events) {
+    conn_t *conn = (conn_t *) eh->data;
+
+    if (conn->state == CONN_CLOSED)
+        return;
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        // client is gone, nothing left to deliver
+        conn_close(conn);
+        return;
+    }
+    conn_run(conn);
+}
+
+void server_handler(event_handler_t *eh, unsigned int events) {
+    conn_t *conn = (conn_t *) eh->data;
+
+    if (conn->state == CONN_CLOSED)
+        return;
+    conn_run(conn);
+}
+
+
+void not_found_handler(int fd) {
+    rio_w_t rio;
+
+    fprintf(stdout, "#not_found_handler process fd %d", fd);
+    rio_writeinitb(&rio, fd);
+    rio_writeb(&rio, "<html>\r\n", 8);
+    rio_writeb(&rio, "<body>\r\n", 8);
+    rio_writeb(&rio, "404: not found", 14);
+    rio_writeb(&rio, "</body>\r\n", 9);
+    rio_writeb(&rio, "</html>\r\n", 9);
+    // the page leaves in one write, client fds are non-blocking so a failure is not fatal
+    if (rio_flushb(&rio, 0) < 0)
+        fprintf(stderr, "#not_found_handler write to fd %d failed: %s\n", fd, strerror(errno));
+}
+
+void bad_request_handler(int fd) {
+    rio_w_t rio;
+
+    fprintf(stdout, "#bad_request_handler process fd %d return 404 message", fd);
+    rio_writeinitb(&rio, fd);
+    rio_writeb(&rio, "<html>\r\n", 8);
+    rio_writeb(&rio, "<body>\r\n", 8);
+    rio_writeb(&rio, "400: bad request", 16);
+    rio_writeb(&rio, "</body>\r\n", 9);
+    rio_writeb(&rio, "</html>\r\n", 9);
+    // the page leaves in one write, client fds are non-blocking so a failure is not fatal
+    if (rio_flushb(&rio, 0) < 0)
+        fprintf(stderr, "#bad_request_handler write to fd %d failed: %s\n", fd, strerror(errno));
+}
+
+const char *head_parser(hdr_id_t id, const char *line, size_t *n) {
+    if (hdrtab[id].request & HDRTAB_REPLACE) {
+        *n = replace_hdrs[id].len;
+        return replace_hdrs[id].line;
+    }
+    // hop-by-hop headers meant for the proxy are not passed on
+    if (hdrtab[id].request & HDRTAB_DROP)
+        *n = 0;
+    return line;
+}
+
+/**
+ * prepare a cached object copied into conn->outbuf for the client: add our
+ * Connection header and keep the connection only if the body is complete
+ * @param conn connection
+ * @param base offset of the object in outbuf, answers to earlier pipelined requests come before it
+ */
+static void conn_cached_response(conn_t *conn, size_t base) {
+    respparse_t *resp = &conn->resp;
+    char *buf = conn->outbuf + base;
+    size_t stripped_len, body_n;
+
+    conn->keep_alive = 0;
+    respparse_init(resp);
+    if (respparse_feed(resp, buf, conn->out_len - base) != RESPPARSE_DONE)
+        return;
+    body_n = conn->out_len - base - resp->head_len;
+    conn->content_length = resp->content_length;
+    stripped_len = respparse_strip(resp, buf, conn->out_len - base, 0);
+    // cached objects are stored with their Content-Length, see conn_cache_length
+    conn->keep_alive = conn->request.keep_alive
+                       && conn->content_length >= 0 && body_n == (size_t) conn->content_length;
+    conn->out_len = base + response_head_insert(buf, stripped_len, stripped_len + body_n,
+                                                conn->keep_alive ? keep_alive_resp_hdr : close_resp_hdr);
 }
 
 /**
  * forward_request method will handover the request body towards
  * to the web server to request data.
- * @param fd file descriptor of the client(client's socket)
- * @param request client's http request body with header data intialized ok
- */
-void forward_request(int fd, request_t request) {
-    int server;
-    size_t n, total_read;
-    char *name, *port_str, http[1024], buf[MAXLINE], cachebuf[MAX_OBJECT_SIZE];
-    rio_t rio;
-    cachebuf[0] = '\0';
-    name = strtok(request.domain, ":");
-    port_str = strtok(NULL, ":");
-    if (name == NULL) {
+ * @param conn client connection whose request has been parsed ok
+ */
+void forward_request(conn_t *conn) {
+    size_t n, base;
+    char *name, *port_str, *hdrs, *host;
+    request_t *request = &conn->request;
+
+    name = request->host;
+    port_str = request->port;
+    if (name == NULL || *name == '\0') {
         fprintf(stderr, "#forward_request receives name content is null exit!\n");
-        free_request(request);
+        conn_close(conn);
         return;
     }
 
@@ -443,72 +2213,62 @@ void forward_request(int fd, request_t request) {
         port_str = "80";
     }
 
+    // only GETs without a body are answered from the cache and stored in it, by path, anything else goes
+    // through to the server with its body streamed behind the head
+    conn->req_body = request->chunked || request->content_length > 0;
+    conn->req_left = request->content_length > 0 ? request->content_length : 0;
+    chunk_init(&conn->req_chunk);
+    if (strcmp(request->method, "GET") != 0 || conn->req_body)
+        request->no_cache = 1;
+
     // we set the cache_key = request#path value
-    char *cache_key = request.path;
-    // we set the cache_value = request#path's proxy local file path
+    char *cache_key = request->path;
     char *cache_value = NULL;
     P(&w);
-    if (get(cache_key) != NULL) {
+    if (strcmp(request->method, "GET") == 0 && !conn->req_body && (cache_value = get(cache_key)) != NULL) {
+        // this means cache hit request key, we directly send data from cache_value -> fd -> client
+        // instead of create connection between client & server
         fprintf(stderr, "#forward_request cache key %s already exists in cache get from cache directly\n",
                 cache_key);
-        cache_value = get(cache_key);
-        V(&w);
-        // this means cache hit request key, we set server = -2 so that
-        // we directly send data from cache_value -> fd -> client instead of create connection between client & server
-        server = -2;
-    } else {
+        n = strlen(cache_value);
+        base = conn->out_len;
+        conn_outbuf_reserve(conn, base + n);
+        memcpy(conn->outbuf + base, cache_value, n);
         V(&w);
-        // proxy's cache cannot locate value by given key read value via connection to server(name:port_str)
-        server = Open_clientfd_r(name, atoi(port_str));
-        fprintf(stderr, "#forward_request proxy connect to server (%s:%s) fd %d\n", name, port_str, server);
-        fprintf(stderr, "#forward_request server fd %d\n", server);
-        // connect ok
-        if (server != -1) {
-            // open write channel and write get command to proxy <-- --> server
-            sprintf(http, "GET /%s HTTP/1.0\r\n", request.path);
-            strcat(http, request.hdrs);
-            Rio_writen(server, http, strlen(http));
-            Rio_writen(server, "\r\n", 2);
-            fprintf(stderr, "#read from server content %s\n", http);
-        } else {
-            // connect failed
-            fprintf(stderr, "#forward_request cannot connect to remote server: (%s:%d)!\n", name, atoi(port_str));
-            return;
-        }
-    }
-
-    fprintf(stderr, "#forward_request begin read via server fd %d\n", server);
-    // read data from server(file descriptor) to rio cache space
-    if (server != -2) {
-        fprintf(stderr, "#foward_request no cache data find read data via server by server fd %d\n", server);
-        Rio_readinitb(&rio, server);
-        char *cur_dir = getcwd(NULL, 0);
-        cur_dir = strcat(cur_dir, "/proxy_cache/");
-        total_read = 0;
-        while ((n = Rio_readlineb(&rio, buf, MAXLINE)) > 0) {
-            fprintf(stderr, "#forward_request read data from buf n %d fd %d\n", n, server);
-            if (total_read + n <= MAX_OBJECT_SIZE) {
-                strcat(cachebuf, buf);
-            }
-            total_read += n;
-            // before we write data via fd to client stream
-            // we also write the buf data to the
-            Rio_writen(fd, buf, n);
-        }
-        // here we cache accumulated webobject from cachebuf -> cache
-        int cache_ret = set(request.path, cachebuf);
-        fprintf(stderr, "#forward_request here we sync data from cachebuf to cache sync result %d\n", cache_ret);
-    } else if (server == -2){
-        fprintf(stderr, "#forward_request match cache value read from proxy local cache to client side \n");
-        // get operation's underlying implement will automatically update the frequency or the lru parameter so the location of the item will be updated
-        char *cache_value = get(request.path);
-        int len = strlen(cache_value);
-        Rio_writen(fd, cache_value, MAX_OBJECT_SIZE);
-        fprintf(stderr, "#forward_request read from cache len %d \ncontent \n%s\n", len, cache_value);
+        conn->out_len = base + n;
+        conn_cached_response(conn, base);
+        conn->state = CONN_WRITE_RESPONSE;
+        fprintf(stderr, "#forward_request read from cache len %zu\n", n);
+        return;
     }
-
-    fprintf(stderr, "#forward_request free request entity here");
-    free_request(request);
+    V(&w);
+
+    // proxy's cache cannot locate value by given key, ask the server (name:port_str) over a pooled connection if any
+    conn->upstream = arena_alloc(&conn->arena, strlen(name) + strlen(port_str) + 2);
+    sprintf(conn->upstream, "%s:%s", name, port_str);
+    conn->upstream_host = name;
+    conn->upstream_port = port_str;
+
+    // rebuild the request for the server: client's method + rewritten headers + empty line, the body keeps
+    // its own framing (Content-Length and Transfer-Encoding pass as they are),
+    // always HTTP/1.1 so the server keeps the connection for the pool, chunks are decoded for HTTP/1.0 clients
+    hdrs = request->hdrs != NULL ? request->hdrs : "";
+    host = request->has_host ? "" : conn->upstream;
+    n = strlen(request->method) + strlen(" / HTTP/1.1\r\n") + strlen(request->path) + strlen(hdrs) + strlen("\r\n");
+    if (*host != '\0')
+        n += strlen("Host: \r\n") + strlen(host);
+    conn->sendbuf = arena_alloc(&conn->arena, n + 1);
+    sprintf(conn->sendbuf, "%s /%s HTTP/1.1\r\n%s%s%s%s\r\n", request->method, request->path,
+            *host != '\0' ? "Host: " : "", host, *host != '\0' ? "\r\n" : "", hdrs);
+    conn->send_len = n;
+    conn->send_off = 0;
+
+    // sized so the slack still fits the pooled class, cachebuf comes with the first response bytes
+    respparse_init(&conn->resp);
+    conn_outbuf_reserve(conn, RELAY_BUFSIZE_MIN - RESP_HDR_SLACK - 1);
+    // a pooled connection that went stale can't be retried once body bytes left inbuf, a body takes a fresh one
+    if (conn_open_server(conn, !conn->req_body) < 0)
+        conn_close(conn);
 }
 
 
@@ -517,8 +2277,8 @@ void reparse(request_t *request) {
     strtok_r(request->pathbuf, "//", &save);
     path = strtok_r(NULL, " ", &save);
     show_request(request);
-    request->path = (char *) Realloc(request->path, strlen(path) + 1);
-    strcpy(request->path, path);
+    // path points into pathbuf, both belong to the request's arena
+    request->path = path;
     show_request(request);
 }
 
@@ -0,0 +1,194 @@
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include "reqparse.h"
+
+/* Parser states, one per kind of line */
+#define RP_REQUEST_LINE 0
+#define RP_FIELDS 1
+#define RP_DONE 2
+#define RP_ERROR 3
+
+/* Lines handed over by one hdrscan_lines call */
+#define REQPARSE_SCAN_BATCH 16
+
+static reqparse_slice_t slice(const char *buf, const char *start, const char *end)
+{
+    reqparse_slice_t s;
+
+    s.off = (uint32_t) (start - buf);
+    s.len = (uint32_t) (end - start);
+    return s;
+}
+
+/* tchar of RFC 7230, what method and field names are made of */
+static const unsigned char tchar[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1, ['+'] = 1,
+    ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0' ... '9'] = 1, ['A' ... 'Z'] = 1, ['a' ... 'z'] = 1,
+};
+
+/**
+ * Split "host[:port]" (host may be a bracketed IPv6 literal) into p->host and p->port.
+ * Userinfo ("user@host") is refused, a port must be 1 to 65535 in at most 5 digits.
+ */
+static int parse_authority(reqparse_t *p, const char *buf, const char *s, const char *end)
+{
+    const char *colon, *d;
+    long port = 0;
+
+    if (memchr(s, '@', end - s) != NULL)
+        return -1;
+    if (s < end && *s == '[') {
+        // IPv6 literal, the brackets stay part of the host
+        if ((colon = memchr(s, ']', end - s)) == NULL)
+            return -1;
+        colon++;
+        if (colon < end && *colon != ':')
+            return -1;
+    } else {
+        colon = memchr(s, ':', end - s);
+        if (colon == NULL)
+            colon = end;
+    }
+    if (colon == s)
+        return -1;
+    if (colon < end) {
+        if (end - (colon + 1) < 1 || end - (colon + 1) > 5)
+            return -1;
+        for (d = colon + 1; d < end; d++) {
+            if (*d < '0' || *d > '9')
+                return -1;
+            port = port * 10 + (*d - '0');
+        }
+        if (port < 1 || port > 65535)
+            return -1;
+    }
+    p->host = slice(buf, s, colon);
+    p->port = slice(buf, colon < end ? colon + 1 : end, end);
+    return 0;
+}
+
+/* "GET http://host:port/path HTTP/1.1", line ends before its CR/LF */
+static int parse_request_line(reqparse_t *p, const char *buf, const char *line, const char *end)
+{
+    const char *s = line, *sp, *uri, *auth;
+
+    while (s < end && tchar[(unsigned char) *s])
+        s++;
+    if (s == line || s == end || *s != ' ')
+        return -1;
+    p->method = slice(buf, line, s);
+
+    uri = s + 1;
+    if ((sp = memchr(uri, ' ', end - uri)) == NULL || sp == uri)
+        return -1;
+    p->uri = slice(buf, uri, sp);
+    // HTTP/1.0 and HTTP/1.1 are the versions we speak, anything else is refused
+    if (end - (sp + 1) != 8 || memcmp(sp + 1, "HTTP/1.", 7) != 0 || (sp[8] != '0' && sp[8] != '1'))
+        return -1;
+    p->http_minor = sp[8] - '0';
+
+    if (sp - uri > 7 && strncasecmp(uri, "http://", 7) == 0) {
+        auth = uri + 7;
+        if ((s = memchr(auth, '/', sp - auth)) == NULL)
+            s = sp;
+        if (parse_authority(p, buf, auth, s) < 0)
+            return -1;
+        p->path = slice(buf, s, sp);
+        return 0;
+    }
+    if (*uri != '/')
+        return -1;
+    // origin form, the Host header names the server
+    p->path = p->uri;
+    return 0;
+}
+
+/* "Name: value", line ends before its CR/LF, colon is the first ':' of the line or NULL */
+static int parse_field(reqparse_t *p, const char *buf, const char *line, const char *colon, const char *end,
+                       const char *next)
+{
+    const char *s, *v, *ve;
+    reqparse_header_t *h;
+
+    if (colon == NULL || colon == line || colon > end)
+        return -1;
+    // no whitespace before the colon, obsolete line folding is refused too
+    for (s = line; s < colon; s++) {
+        if (!tchar[(unsigned char) *s])
+            return -1;
+    }
+    if (p->nheaders == REQPARSE_MAX_HEADERS)
+        return -1;
+    for (v = colon + 1; v < end && (*v == ' ' || *v == '\t'); v++);
+    for (ve = end; ve > v && (ve[-1] == ' ' || ve[-1] == '\t'); ve--);
+    h = &p->headers[p->nheaders++];
+    h->name = slice(buf, line, colon);
+    h->value = slice(buf, v, ve);
+    h->line = slice(buf, line, next);
+    return 0;
+}
+
+void reqparse_init(reqparse_t *p)
+{
+    // headers[] is filled as lines come, no need to clear it
+    memset(p, 0, offsetof(reqparse_t, headers));
+    p->nheaders = 0;
+    p->head_len = 0;
+    p->state = RP_REQUEST_LINE;
+    hdrscan_start(&p->scan, 0);
+}
+
+int reqparse_feed(reqparse_t *p, const char *buf, size_t len)
+{
+    hdrscan_line_t lines[REQPARSE_SCAN_BATCH];
+    const char *line, *lf, *end;
+    const reqparse_header_t *h;
+    int i, n;
+
+    while (p->state == RP_REQUEST_LINE || p->state == RP_FIELDS) {
+        // the next lines of the new bytes in one pass, the scan resumes there on the next feed
+        if ((n = hdrscan_lines(&p->scan, buf, len, lines, REQPARSE_SCAN_BATCH)) == 0)
+            return REQPARSE_AGAIN;
+        for (i = 0; i < n && (p->state == RP_REQUEST_LINE || p->state == RP_FIELDS); i++) {
+            line = buf + p->pos;
+            lf = buf + lines[i].nl;
+            end = (lf > line && lf[-1] == '\r') ? lf - 1 : lf;
+            p->pos = lines[i].nl + 1;
+            if (p->state == RP_REQUEST_LINE) {
+                p->state = parse_request_line(p, buf, line, end) < 0 ? RP_ERROR : RP_FIELDS;
+            } else if (end == line) {
+                p->head_len = p->pos;
+                p->state = RP_DONE;
+            } else if (parse_field(p, buf, line, lines[i].colon == HDRSCAN_NONE ? NULL : buf + lines[i].colon,
+                                   end, lf + 1) < 0) {
+                p->state = RP_ERROR;
+            }
+        }
+    }
+    if (p->state == RP_ERROR)
+        return REQPARSE_ERROR;
+
+    if (p->host.len == 0) {
+        // origin form request, only the Host header can tell where it goes
+        if ((h = reqparse_header(p, buf, "Host")) == NULL
+            || parse_authority(p, buf, buf + h->value.off, buf + h->value.off + h->value.len) < 0) {
+            p->state = RP_ERROR;
+            return REQPARSE_ERROR;
+        }
+    }
+    return REQPARSE_DONE;
+}
+
+const reqparse_header_t *reqparse_header(const reqparse_t *p, const char *buf, const char *name)
+{
+    size_t n = strlen(name);
+    int i;
+
+    for (i = 0; i < p->nheaders; i++) {
+        if (p->headers[i].name.len == n && strncasecmp(buf + p->headers[i].name.off, name, n) == 0)
+            return &p->headers[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,72 @@
+/* $begin reqparse.h */
+#ifndef __REQPARSE_H__
+#define __REQPARSE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hdrscan.h"
+
+/* Header fields kept per request, a request with more is rejected */
+#define REQPARSE_MAX_HEADERS 64
+
+/* reqparse_feed results */
+#define REQPARSE_DONE 1         /* whole head parsed, head_len is set */
+#define REQPARSE_AGAIN 0        /* head not complete yet, feed again once more bytes arrived */
+#define REQPARSE_ERROR -1       /* not a request we can forward */
+
+/**
+ * a piece of the input buffer, as an offset from its start so it stays
+ * valid when the buffer is grown (moved) between two feeds
+ */
+typedef struct reqparse_slice_t {
+    uint32_t off;
+    uint32_t len;
+} reqparse_slice_t;
+
+typedef struct reqparse_header_t {
+    reqparse_slice_t name;
+    reqparse_slice_t value;     /* leading and trailing whitespace stripped */
+    reqparse_slice_t line;      /* whole field line, CRLF included */
+} reqparse_header_t;
+
+/**
+ * incremental request head parser. It never copies or modifies the input:
+ * every field is a slice of the caller's buffer. Line ends and colons are
+ * found by hdrscan in one pass over the new bytes of each feed, a line is
+ * parsed once its end arrived.
+ *
+ * the request target may be absolute ("http://host[:port]/path") or origin
+ * form ("/path", the server then comes from the Host header)
+ */
+typedef struct reqparse_t {
+    size_t pos;                 /* start of the first line not parsed yet */
+    hdrscan_t scan;             /* line ends and colons found up to scan.pos */
+    int state;
+    reqparse_slice_t method;
+    reqparse_slice_t uri;       /* request target as sent */
+    reqparse_slice_t host;
+    reqparse_slice_t port;      /* len 0 when there is none */
+    reqparse_slice_t path;      /* from the '/' on, len 0 for "http://host" */
+    int http_minor;             /* HTTP/1.0 or HTTP/1.1 */
+    reqparse_header_t headers[REQPARSE_MAX_HEADERS];
+    int nheaders;
+    size_t head_len;            /* bytes of the head, empty line included */
+} reqparse_t;
+
+void reqparse_init(reqparse_t *p);
+
+/**
+ * parse what is new in buf
+ * @param buf input, always from the first byte of the request
+ * @param len bytes in buf, at least as many as the last time
+ * @return REQPARSE_DONE, REQPARSE_AGAIN or REQPARSE_ERROR
+ */
+int reqparse_feed(reqparse_t *p, const char *buf, size_t len);
+
+/**
+ * the header named name (case insensitive), NULL when the request has none
+ */
+const reqparse_header_t *reqparse_header(const reqparse_t *p, const char *buf, const char *name);
+
+#endif /* __REQPARSE_H__ */
+/* $end reqparse.h */
@@ -0,0 +1,241 @@
+#include <string.h>
+#include "hdrtab.h"
+#include "respparse.h"
+
+/* Parser states, one per kind of line */
+#define RESP_STATUS_LINE 0
+#define RESP_FIELDS 1
+#define RESP_DONE 2
+#define RESP_ERROR 3
+
+/* Lines handed over by one hdrscan_lines call */
+#define RESPPARSE_SCAN_BATCH 16
+
+/* "HTTP/1.1 200 OK", line ends before its CR/LF */
+static int parse_status_line(respparse_t *p, const char *line, const char *end)
+{
+    if (end - line < 12 || memcmp(line, "HTTP/1.", 7) != 0 || line[7] < '0' || line[7] > '9' || line[8] != ' '
+        || line[9] < '1' || line[9] > '5' || line[10] < '0' || line[10] > '9' || line[11] < '0' || line[11] > '9')
+        return -1;
+    p->http_minor = line[7] - '0';
+    p->status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    // HTTP/1.1 servers keep the connection unless they say close, older ones only on request
+    p->server_close = p->http_minor < 1;
+    return 0;
+}
+
+/* learn what the proxy needs from one header, value[0..len) without surrounding whitespace */
+static void parse_field(respparse_t *p, hdr_id_t id, const char *value, size_t len)
+{
+    long n;
+
+    switch (id) {
+    case HDR_CONNECTION:
+    case HDR_PROXY_CONNECTION:
+    case HDR_KEEP_ALIVE:
+        if (hdrtab_has_token(value, len, "close"))
+            p->server_close = 1;
+        else if (hdrtab_has_token(value, len, "keep-alive"))
+            p->server_close = 0;
+        break;
+    case HDR_CONTENT_LENGTH:
+        // a length we can't trust may leave body bytes on a pooled connection, see respparse_feed
+        n = hdrtab_content_length(value, len);
+        if (n < 0 || (p->content_length >= 0 && p->content_length != n))
+            p->bad_length = 1;
+        else
+            p->content_length = n;
+        break;
+    case HDR_TRANSFER_ENCODING:
+        // only chunked applied last frames the body, the last line has the last coding
+        p->chunked = hdrtab_last_token(value, len, "chunked");
+        break;
+    case HDR_CACHE_CONTROL:
+        // we never revalidate, so an object that has to be is as good as uncacheable
+        if (hdrtab_has_token(value, len, "no-store") || hdrtab_has_token(value, len, "private")
+            || hdrtab_has_token(value, len, "no-cache") || hdrtab_has_token(value, len, "max-age=0")
+            || hdrtab_has_token(value, len, "s-maxage=0"))
+            p->no_cache = "Cache-Control";
+        break;
+    case HDR_PRAGMA:
+        if (hdrtab_has_token(value, len, "no-cache"))
+            p->no_cache = "Pragma";
+        break;
+    case HDR_SET_COOKIE:
+        p->no_cache = "Set-Cookie";
+        break;
+    case HDR_VARY:
+        // the cache is keyed by path only, it can't keep variants apart
+        p->no_cache = "Vary";
+        break;
+    default:
+        break;
+    }
+}
+
+/* status codes whose responses the cache may keep (RFC 7231 6.1, without the ones we can't replay) */
+static int status_cacheable(int status)
+{
+    switch (status) {
+    case 200:
+    case 203:
+    case 204:
+    case 300:
+    case 301:
+    case 404:
+    case 410:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* add the Content-Length lines to the lines to drop, which stay in buffer order */
+static int drop_lengths(respparse_t *p)
+{
+    int i, j;
+
+    if (p->ndrop + p->nlength > RESPPARSE_MAX_DROP)
+        return -1;
+    for (i = 0; i < p->nlength; i++) {
+        for (j = p->ndrop; j > 0 && p->drop[j - 1].off > p->length[i].off; j--)
+            p->drop[j] = p->drop[j - 1];
+        p->drop[j] = p->length[i];
+        p->ndrop++;
+    }
+    return 0;
+}
+
+void respparse_init(respparse_t *p)
+{
+    memset(p, 0, offsetof(respparse_t, drop));
+    p->content_length = -1;
+    p->ndrop = 0;
+    p->head_len = 0;
+    p->state = RESP_STATUS_LINE;
+    hdrscan_start(&p->scan, 0);
+}
+
+int respparse_feed(respparse_t *p, const char *buf, size_t len)
+{
+    hdrscan_line_t lines[RESPPARSE_SCAN_BATCH];
+    const char *line, *end, *v, *ve;
+    size_t name;
+    hdr_id_t id;
+    int i, n, bodiless;
+
+    while (p->state == RESP_STATUS_LINE || p->state == RESP_FIELDS) {
+        if ((n = hdrscan_lines(&p->scan, buf, len, lines, RESPPARSE_SCAN_BATCH)) == 0)
+            return RESPPARSE_AGAIN;
+        for (i = 0; i < n && (p->state == RESP_STATUS_LINE || p->state == RESP_FIELDS); i++) {
+            line = buf + p->pos;
+            end = buf + lines[i].nl;
+            if (end > line && end[-1] == '\r')
+                end--;
+            if (p->state == RESP_STATUS_LINE) {
+                p->state = parse_status_line(p, line, end) < 0 ? RESP_ERROR : RESP_FIELDS;
+            } else if (end == line) {
+                p->head_len = lines[i].nl + 1;
+                p->state = RESP_DONE;
+            } else if (lines[i].colon != HDRSCAN_NONE && buf + lines[i].colon < end) {
+                name = buf + lines[i].colon - line;
+                id = hdrtab_lookup(line, name);
+                if (hdrtab[id].response & HDRTAB_EXTRACT) {
+                    for (v = line + name + 1; v < end && (*v == ' ' || *v == '\t'); v++);
+                    for (ve = end; ve > v && (ve[-1] == ' ' || ve[-1] == '\t'); ve--);
+                    parse_field(p, id, v, ve - v);
+                }
+                if (id == HDR_CONTENT_LENGTH) {
+                    if (p->nlength == RESPPARSE_MAX_LENGTH) {
+                        p->state = RESP_ERROR;
+                        break;
+                    }
+                    p->length[p->nlength].off = (uint32_t) p->pos;
+                    p->length[p->nlength].len = lines[i].nl + 1 - (uint32_t) p->pos;
+                    p->nlength++;
+                }
+                if (id == HDR_TRANSFER_ENCODING) {
+                    if (p->nte == RESPPARSE_MAX_TE) {
+                        p->state = RESP_ERROR;
+                        break;
+                    }
+                    p->te[p->nte].off = (uint32_t) p->pos;
+                    p->te[p->nte].len = lines[i].nl + 1 - (uint32_t) p->pos;
+                    p->nte++;
+                }
+                if (hdrtab[id].response & HDRTAB_DROP) {
+                    if (p->ndrop == RESPPARSE_MAX_DROP) {
+                        p->state = RESP_ERROR;
+                        break;
+                    }
+                    p->drop[p->ndrop].off = (uint32_t) p->pos;
+                    p->drop[p->ndrop].len = lines[i].nl + 1 - (uint32_t) p->pos;
+                    p->ndrop++;
+                }
+            }
+            // lines that are no field (no colon, folded ones) are passed on untouched
+            p->pos = lines[i].nl + 1;
+        }
+    }
+    if (p->state == RESP_ERROR)
+        return RESPPARSE_ERROR;
+
+    bodiless = (p->status >= 100 && p->status < 200) || p->status == 204 || p->status == 304;
+    // a length we can't trust is no length, neither is one next to a Transfer-Encoding: the lines go
+    if ((p->bad_length || p->nte > 0) && drop_lengths(p) < 0) {
+        p->state = RESP_ERROR;
+        return RESPPARSE_ERROR;
+    }
+    // and the body ends when the server closes, unless the status says there is no body at all
+    if (p->bad_length) {
+        p->content_length = -1;
+        if (!bodiless)
+            p->server_close = 1;
+        if (p->no_cache == NULL)
+            p->no_cache = "Content-Length";
+    }
+    // codings that don't end with chunked leave the end of the body to the server closing (RFC 7230 3.3.3)
+    if (p->nte > 0 && !p->chunked && !bodiless) {
+        p->content_length = -1;
+        p->server_close = 1;
+    }
+    // these never carry a body whatever the head says, not even a last chunk,
+    // elsewhere chunked framing wins over a Content-Length
+    if (bodiless) {
+        p->content_length = 0;
+        p->chunked = 0;
+    } else if (p->chunked) {
+        p->content_length = -1;
+    }
+    if (p->no_cache == NULL && !status_cacheable(p->status))
+        p->no_cache = "status";
+    return RESPPARSE_DONE;
+}
+
+size_t respparse_strip(const respparse_t *p, char *buf, size_t len, int flags)
+{
+    size_t src = 0, dst = 0, n;
+    const respparse_drop_t *d;
+    int i = 0, j = 0, nte = (flags & RESPPARSE_STRIP_TE) ? p->nte : 0;
+
+    for (;;) {
+        // next line to drop in buffer order, the Transfer-Encoding lines merged into the hop-by-hop ones
+        if (j < nte && (i == p->ndrop || p->te[j].off < p->drop[i].off))
+            d = &p->te[j];
+        else
+            d = i < p->ndrop ? &p->drop[i] : NULL;
+        // keep what lies between two dropped lines, the last piece runs to the end of the body
+        n = (d != NULL ? d->off : len) - src;
+        if (dst != src)
+            memmove(buf + dst, buf + src, n);
+        dst += n;
+        if (d == NULL)
+            break;
+        if (j < nte && d == &p->te[j])
+            j++;
+        else
+            i++;
+        src = d->off + d->len;
+    }
+    return p->head_len - (len - dst);
+}
@@ -0,0 +1,80 @@
+/* $begin respparse.h */
+#ifndef __RESPPARSE_H__
+#define __RESPPARSE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hdrscan.h"
+
+/* Hop-by-hop lines a head may carry, a head with more is relayed untouched */
+#define RESPPARSE_MAX_DROP 16
+
+/* Content-Length lines a head may carry, a head with more is relayed untouched */
+#define RESPPARSE_MAX_LENGTH 4
+
+/* Transfer-Encoding lines a head may carry, a head with more is relayed untouched */
+#define RESPPARSE_MAX_TE 4
+
+/* respparse_feed results */
+#define RESPPARSE_DONE 1        /* whole head parsed, head_len and the decisions are set */
+#define RESPPARSE_AGAIN 0       /* head not complete yet, feed again once more bytes arrived */
+#define RESPPARSE_ERROR -1      /* no HTTP/1.x status line, or too many lines to drop */
+
+/* respparse_strip flags */
+#define RESPPARSE_STRIP_TE 1    /* also leave out Transfer-Encoding, the body goes on without chunk framing */
+
+/* a line of the head to leave out, offsets from the start of the buffer */
+typedef struct respparse_drop_t {
+    uint32_t off;
+    uint32_t len;
+} respparse_drop_t;
+
+/**
+ * incremental response head parser. Each feed only looks at the bytes that
+ * arrived since the last one (line ends and colons come from hdrscan), so by
+ * the time the empty line shows up everything needed to relay the body is
+ * known: status, how the body is delimited, whether the server keeps the
+ * connection and whether the object may go to the cache. The buffer is only
+ * modified by respparse_strip.
+ */
+typedef struct respparse_t {
+    size_t pos;                 /* start of the first line not parsed yet */
+    hdrscan_t scan;
+    int state;
+    int status;                 /* status code, 0 until the status line is parsed */
+    int http_minor;             /* HTTP/1.x */
+    long content_length;        /* body length, -1 when the body is not delimited by it */
+    int bad_length;             /* broken or conflicting Content-Length, the body runs until the server closes */
+    int chunked;                /* Transfer-Encoding ends with chunked */
+    int server_close;           /* server closes the connection after this response */
+    const char *no_cache;       /* why the object must not be cached, NULL when it may be */
+    int nte;                    /* Transfer-Encoding lines, 0 without one */
+    int nlength;
+    respparse_drop_t drop[RESPPARSE_MAX_DROP];
+    int ndrop;
+    respparse_drop_t length[RESPPARSE_MAX_LENGTH]; /* the Content-Length lines, dropped when bad_length or
+                                                      a Transfer-Encoding frames the body */
+    respparse_drop_t te[RESPPARSE_MAX_TE]; /* the Transfer-Encoding lines in buffer order */
+    size_t head_len;            /* bytes of the head as received, empty line included */
+} respparse_t;
+
+void respparse_init(respparse_t *p);
+
+/**
+ * parse what is new in buf
+ * @param buf input, always from the first byte of the response
+ * @param len bytes in buf, at least as many as the last time
+ * @return RESPPARSE_DONE, RESPPARSE_AGAIN or RESPPARSE_ERROR
+ */
+int respparse_feed(respparse_t *p, const char *buf, size_t len);
+
+/**
+ * once respparse_feed returned RESPPARSE_DONE: remove the hop-by-hop lines
+ * from the head in buf and move the len - head_len body bytes behind it
+ * @param flags 0 or RESPPARSE_STRIP_TE
+ * @return length of the stripped head
+ */
+size_t respparse_strip(const respparse_t *p, char *buf, size_t len, int flags);
+
+#endif /* __RESPPARSE_H__ */
+/* $end respparse.h */
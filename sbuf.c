@@ -1,14 +1,73 @@
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include "sbuf.h"
 
-/* Create an empty, bounded, shared FIFO buffer with n slots */
+/*
+ * The queue itself never takes a lock: producers and consumers claim
+ * slots by CAS on rear / front and hand items over through the cell
+ * sequence numbers. Threads only enter the kernel (futex) to sleep when
+ * the buffer is full or empty, and only get woken when someone sleeps.
+ */
+
+static void futex_wait(unsigned int *addr, unsigned int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Wake one thread parked on word if there is any */
+static void sbuf_signal(unsigned int *word, int *waiters)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0) {
+        __atomic_fetch_add(word, 1, __ATOMIC_SEQ_CST);
+        futex_wake(word);
+    }
+}
+
+/* Insert item unless sp is full, returns -1 if it is */
+static int sbuf_push(sbuf_t *sp, int item)
+{
+    size_t pos = __atomic_load_n(&sp->rear, __ATOMIC_RELAXED);
+    sbuf_cell_t *cell;
+    long diff;
+
+    while (1) {
+        cell = &sp->buf[pos & sp->mask];
+        diff = (long) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long) pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&sp->rear, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;          /* Slot still holds the item from one lap ago */
+        } else {
+            pos = __atomic_load_n(&sp->rear, __ATOMIC_RELAXED);
+        }
+    }
+    cell->item = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Create an empty, bounded, shared FIFO buffer with at least n slots */
 void sbuf_init(sbuf_t *sp, int n)
 {
-    sp->buf = Calloc(n, sizeof(int));
-    sp->n = n;			/* Buffer holds max of n items */
+    size_t i, cap = 2;
+
+    while (cap < (size_t) n)
+        cap <<= 1;
+    sp->buf = Calloc(cap, sizeof(sbuf_cell_t));
+    sp->n = cap;			/* Buffer holds max of n items */
+    sp->mask = cap - 1;
+    for (i = 0; i < cap; i++)
+        sp->buf[i].seq = i;		/* Cell i is free for the insert at position i */
     sp->front = sp->rear = 0;	/* Empty buffer iff front == rear */
-    Sem_init(&sp->mutex, 0, 1);	/* Binary semaphore for locking */
-    Sem_init(&sp->slots, 0, n);	/* Initially, buf has n empty slots */
-    Sem_init(&sp->items, 0, 0);	/* Initially, buf has zero data items */
+    sp->not_empty = sp->not_full = 0;
+    sp->consumers = sp->producers = 0;
 }
 
 /* Clean up buffer sp */
@@ -20,21 +79,87 @@ void sbuf_deinit(sbuf_t *sp)
 /* Insert item onto the rear of shared buffer sp */
 void sbuf_insert(sbuf_t *sp, int item)
 {
-    P(&sp->slots);				/* Wait for available slot */
-    P(&sp->mutex);				/* Lock the buffer */
-    sp->buf[(++sp->rear)%(sp->n)] = item;	/* Insert the item */
-    V(&sp->mutex);				/* Unlock the buffer */
-    V(&sp->items);				/* Announce available item */
+    unsigned int seq;
+
+    while (sbuf_push(sp, item) < 0) {
+        /* Full: park until a remove frees a slot, recheck after announcing ourselves */
+        seq = __atomic_load_n(&sp->not_full, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&sp->producers, 1, __ATOMIC_SEQ_CST);
+        if (sbuf_push(sp, item) == 0) {
+            __atomic_fetch_sub(&sp->producers, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        futex_wait(&sp->not_full, seq);
+        __atomic_fetch_sub(&sp->producers, 1, __ATOMIC_SEQ_CST);
+    }
+    sbuf_signal(&sp->not_empty, &sp->consumers);	/* Announce available item */
+}
+
+/* Insert item onto the rear of shared buffer sp without waiting,
+   returns -1 if sp is full */
+int sbuf_try_insert(sbuf_t *sp, int item)
+{
+    if (sbuf_push(sp, item) < 0)
+        return -1;
+    sbuf_signal(&sp->not_empty, &sp->consumers);
+    return 0;
 }
 
 /* Remove and return the first item from buffer sp */
 int sbuf_remove(sbuf_t *sp)
 {
+    unsigned int seq;
     int item;
-    P(&sp->items);				/* Wait for available item */
-    P(&sp->mutex);				/* Lock the buffer */
-    item = sp->buf[(++sp->front)%(sp->n)];	/* Remove the item */
-    V(&sp->mutex);				/* Unlock the buffer */
-    V(&sp->slots);				/* Announce available slot */
+
+    while ((item = sbuf_try_remove(sp)) < 0) {
+        /* Empty: park until an insert shows up, recheck after announcing ourselves */
+        seq = __atomic_load_n(&sp->not_empty, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&sp->consumers, 1, __ATOMIC_SEQ_CST);
+        if ((item = sbuf_try_remove(sp)) >= 0) {
+            __atomic_fetch_sub(&sp->consumers, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        futex_wait(&sp->not_empty, seq);
+        __atomic_fetch_sub(&sp->consumers, 1, __ATOMIC_SEQ_CST);
+    }
     return item;
 }
+
+/* Remove and return the first item from buffer sp without waiting,
+   returns -1 if sp is empty */
+int sbuf_try_remove(sbuf_t *sp)
+{
+    size_t pos = __atomic_load_n(&sp->front, __ATOMIC_RELAXED);
+    sbuf_cell_t *cell;
+    long diff;
+    int item;
+
+    while (1) {
+        cell = &sp->buf[pos & sp->mask];
+        diff = (long) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long) (pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&sp->front, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;          /* No item available */
+        } else {
+            pos = __atomic_load_n(&sp->front, __ATOMIC_RELAXED);
+        }
+    }
+    item = cell->item;
+    __atomic_store_n(&cell->seq, pos + sp->mask + 1, __ATOMIC_RELEASE);	/* Free the cell for the next lap */
+    sbuf_signal(&sp->not_full, &sp->producers);	/* Announce available slot */
+    return item;
+}
+
+/* Number of items in buffer sp, only a snapshot while others insert/remove */
+int sbuf_depth(sbuf_t *sp)
+{
+    size_t front = __atomic_load_n(&sp->front, __ATOMIC_RELAXED);
+    size_t rear = __atomic_load_n(&sp->rear, __ATOMIC_RELAXED);
+    long depth = (long) (rear - front);
+
+    if (depth < 0)
+        return 0;
+    return depth > sp->n ? sp->n : (int) depth;
+}
@@ -4,30 +4,43 @@
 
 #include "csapp.h"
 
+#define SBUF_CACHELINE 64
+
+/* One ring slot, seq tells whose turn it is (Vyukov's bounded MPMC queue) */
+typedef struct {
+    size_t seq;
+    int item;
+} sbuf_cell_t;
+
 struct sbuf_t{
-    int *buf;
+    sbuf_cell_t *buf;
     int n;
-    int front;
-    int rear;
-    sem_t mutex;
-    sem_t slots;
-    sem_t items;
-};
+    size_t mask;
+    size_t rear __attribute__((aligned(SBUF_CACHELINE)));
+    size_t front __attribute__((aligned(SBUF_CACHELINE)));
+    unsigned int not_empty __attribute__((aligned(SBUF_CACHELINE)));
+    unsigned int not_full;
+    int consumers;
+    int producers;
+} __attribute__((aligned(SBUF_CACHELINE)));
 typedef struct sbuf_t sbuf_t;
 
-/* Buffer array */
+/* Buffer array, a power of two number of cells */
 /* Maximum number of slots */
-/* buf[(front+1)%n] is first item */
-/* buf[rear%n] is last item */
-/* Protects accesses to buf */
-/* Counts available slots */
-/* Counts available items */
+/* Cell index mask, n - 1 */
+/* Next slot to insert into, own cache line */
+/* Next slot to remove from, own cache line */
+/* Futex words bumped when an item / a slot shows up */
+/* Threads parked on not_empty */
+/* Threads parked on not_full */
 
 void sbuf_init(sbuf_t* sp, int n);
 void sbuf_deinit(sbuf_t *sp);
 void sbuf_insert(sbuf_t *sp, int item);
+int sbuf_try_insert(sbuf_t *sp, int item);
 int sbuf_remove(sbuf_t *sp);
+int sbuf_try_remove(sbuf_t *sp);
+int sbuf_depth(sbuf_t *sp);
 
 #endif /* __SBUF_H__ */
 /* $end sbuf.h */
-
@@ -0,0 +1,56 @@
+/* splice(2) and pipe2(2) are GNU extensions, csapp.h can't live with _GNU_SOURCE so it is not included here */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "splicer.h"
+
+int splicer_open(splicer_t *sp)
+{
+    int fds[2];
+
+    sp->rfd = sp->wfd = -1;
+    sp->len = 0;
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+    sp->rfd = fds[0];
+    sp->wfd = fds[1];
+    return 0;
+}
+
+void splicer_close(splicer_t *sp)
+{
+    if (sp->rfd >= 0)
+        close(sp->rfd);
+    if (sp->wfd >= 0)
+        close(sp->wfd);
+    sp->rfd = sp->wfd = -1;
+    sp->len = 0;
+}
+
+ssize_t splicer_fill(splicer_t *sp, int fd, size_t max)
+{
+    ssize_t n;
+
+    if (max > SPLICER_CHUNK)
+        max = SPLICER_CHUNK;
+    while ((n = splice(fd, NULL, sp->wfd, NULL, max, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 && errno == EINTR);
+    if (n > 0)
+        sp->len += n;
+    return n;
+}
+
+int splicer_drain(splicer_t *sp, int fd)
+{
+    ssize_t n;
+
+    while (sp->len > 0) {
+        if ((n = splice(sp->rfd, NULL, fd, NULL, sp->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        sp->len -= n;
+    }
+    return 1;
+}
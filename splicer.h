@@ -0,0 +1,40 @@
+/* $begin splicer.h */
+#ifndef __SPLICER_H__
+#define __SPLICER_H__
+
+#include <sys/types.h>
+
+/* Max bytes moved into the pipe by one splicer_fill */
+#define SPLICER_CHUNK 65536
+
+/**
+ * a pipe used to move bytes between two sockets with splice(2), the data
+ * never enters user space. len counts bytes sitting in the pipe.
+ */
+typedef struct splicer_t {
+    int rfd;
+    int wfd;
+    size_t len;
+} splicer_t;
+
+/**
+ * create the non-blocking pipe
+ * @return 0 on success, -1 with errno set on failure
+ */
+int splicer_open(splicer_t *sp);
+void splicer_close(splicer_t *sp);
+
+/**
+ * move up to max bytes (at most SPLICER_CHUNK) from socket fd into the pipe
+ * @return bytes moved, 0 on EOF, -1 with errno set (EAGAIN when fd has no data)
+ */
+ssize_t splicer_fill(splicer_t *sp, int fd, size_t max);
+
+/**
+ * move everything in the pipe to socket fd
+ * @return 1 when the pipe is empty, 0 when fd would block, -1 with errno set
+ */
+int splicer_drain(splicer_t *sp, int fd);
+
+#endif /* __SPLICER_H__ */
+/* $end splicer.h */
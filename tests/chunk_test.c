@@ -0,0 +1,66 @@
+/*
+ * chunk_test - feeds chunked bodies to chunk_decode in pieces of every size
+ *     up to the whole body and checks where the body ends and that broken
+ *     framing is caught as CHUNK_ERROR instead of being read as a body end.
+ *
+ *     usage: ./chunk_test, exits 1 when a case fails
+ */
+#include <stdio.h>
+#include <string.h>
+#include "../chunk.h"
+
+typedef struct {
+    const char *body;
+    int valid;          /* framing is fine, the body ends at end */
+    size_t end;         /* bytes of body that belong to it when valid */
+    const char *data;   /* decoded chunk data when valid */
+} chunk_case_t;
+
+static const chunk_case_t cases[] = {
+    { "5\r\nhello\r\n0\r\n\r\n", 1, 15, "hello" },
+    { "5\r\nhello\r\n0\r\n\r\nGET / HTTP/1.1\r\n", 1, 15, "hello" },
+    { "5;x=y\nhello\n3\r\nabc\r\n0\r\nT: v\r\n\r\n", 1, 31, "helloabc" },
+    { "5\r\nhelloXX\r\n0\r\n\r\n", 0, 0, NULL },
+    { "\r\n0\r\n\r\n", 0, 0, NULL },
+    { ";x\r\n0\r\n\r\n", 0, 0, NULL },
+    { "5\r\nhello\rX0\r\n\r\n", 0, 0, NULL },
+    { "zz\r\n\r\n", 0, 0, NULL },
+};
+
+/* decode body in pieces of step bytes, 0 when the case holds */
+static int run(const chunk_case_t *t, size_t step) {
+    char out[256];
+    size_t n = strlen(t->body), i = 0, o = 0, k, used;
+    chunk_t c;
+
+    chunk_init(&c);
+    while (i < n && !c.done && c.state != CHUNK_ERROR) {
+        k = n - i < step ? n - i : step;
+        used = chunk_decode(&c, t->body + i, k, out + o, &k);
+        o += k;
+        i += used;
+    }
+    if (!t->valid)
+        return c.state == CHUNK_ERROR ? 0 : -1;
+    if (!c.done || c.state == CHUNK_ERROR || i != t->end)
+        return -1;
+    return o == strlen(t->data) && memcmp(out, t->data, o) == 0 ? 0 : -1;
+}
+
+int main(void) {
+    size_t i, step;
+    int failed = 0;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        for (step = 1; step <= strlen(cases[i].body); step++) {
+            if (run(&cases[i], step) < 0) {
+                printf("FAIL case %zu (step %zu): ", i, step);
+                fwrite(cases[i].body, 1, strlen(cases[i].body), stdout);
+                printf("\n");
+                failed = 1;
+            }
+        }
+    }
+    printf("%s\n", failed ? "chunk_test failed" : "chunk_test ok");
+    return failed;
+}
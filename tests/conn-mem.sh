@@ -0,0 +1,44 @@
+#!/bin/bash
+# memory per client connection of a running proxy
+# usage: tests/conn-mem.sh <proxy port> <url> [connections]
+# opens the connections in two rounds and reports the proxy's resident (VmRSS)
+# and allocated (VmData) memory growth per connection:
+#   idle    - every connection got a keep-alive response and waits for its next request
+#   reading - every connection sent half a request head and waits
+
+port=$1
+url=$2
+n=${3:-1000}
+pid=$(pidof -s proxy)
+if [ -z "$port" ] || [ -z "$url" ] || [ -z "$pid" ]; then
+    echo "usage: $0 <proxy port> <url> [connections], with ./proxy running"
+    exit 1
+fi
+hostport=${url#http://}
+hostport=${hostport%%/*}
+
+mem() { awk -v k="$1:" '$1 == k { print $2 }' /proc/$pid/status; }
+
+round() {
+    local fds=() fd i rss0 vm0
+    rss0=$(mem VmRSS); vm0=$(mem VmData)
+    for ((i = 0; i < n; i++)); do
+        exec {fd}<>/dev/tcp/localhost/$port || break
+        fds+=($fd)
+        if [ "$1" = reading ]; then
+            printf 'GET %s HTTP/1.1\r\nHost: %s\r\n' "$url" "$hostport" >&$fd
+        else
+            printf 'GET %s HTTP/1.1\r\nHost: %s\r\n\r\n' "$url" "$hostport" >&$fd
+        fi
+    done
+    sleep 2
+    echo "$1: ${#fds[@]} connections, $(( ($(mem VmRSS) - rss0) * 1024 / ${#fds[@]} )) bytes resident" \
+         "$(( ($(mem VmData) - vm0) * 1024 / ${#fds[@]} )) bytes allocated per connection"
+    for fd in "${fds[@]}"; do
+        exec {fd}>&-
+    done
+    sleep 1
+}
+
+round idle
+round reading
@@ -0,0 +1,227 @@
+/*
+ * parse_bench - micro-benchmark of reqparse_feed against the request head
+ *     handling it replaced: strstr for the empty line, a strtok_r copy of
+ *     the request line and two memchr walks over the header lines (sizing
+ *     and copying them, where request_processor now uses the slices). Both parse
+ *     the same realistic head over and over, once as a whole and once
+ *     arriving in small pieces like a slow client sends it. reqparse_feed
+ *     runs once with every header scanner (hdrscan.c) the CPU supports,
+ *     which are also timed alone over a 64 KB block of header lines.
+ *
+ *     usage: ./parse_bench [MB of heads per round, default 256] [piece size, default 16]
+ */
+#include "../csapp.h"
+#include "../arena.h"
+#include "../reqparse.h"
+
+/* the original head handling, kept here as the baseline */
+static int old_parse_req(char *buf, arena_t *arena, char **domain, char **path) {
+    char *save, *p;
+
+    arena_strndup(arena, buf, strlen(buf));
+    strtok_r(buf, " ", &save);
+    strtok_r(NULL, "//", &save);
+    if ((p = strtok_r(NULL, "/", &save)) == NULL)
+        return -1;
+    *domain = arena_strndup(arena, p, strlen(p));
+    if ((p = strtok_r(NULL, " ", &save)) == NULL)
+        return -1;
+    *path = arena_strndup(arena, p, strlen(p));
+    return 0;
+}
+
+/* whole head in buf[0..len), returns the number of header lines or -1 */
+static int old_parse(char *buf, size_t len, arena_t *arena) {
+    char *end, *line, *next, *domain, *path;
+    int n = 0;
+
+    buf[len] = '\0';
+    if ((end = strstr(buf, "\r\n\r\n")) == NULL)
+        return -1;
+    end[2] = '\0';
+    next = memchr(buf, '\n', end - buf) + 1;
+    if (old_parse_req(arena_strndup(arena, buf, next - buf), arena, &domain, &path) < 0)
+        return -1;
+    // request_processor walked the header lines twice, once to size and once to copy them
+    for (line = next; line < end + 2; line = next) {
+        next = memchr(line, '\n', end + 2 - line);
+        next = (next != NULL) ? next + 1 : end + 2;
+    }
+    for (line = memchr(buf, '\n', end - buf) + 1; line < end + 2; line = next) {
+        next = memchr(line, '\n', end + 2 - line);
+        next = (next != NULL) ? next + 1 : end + 2;
+        n++;
+    }
+    end[2] = '\r';
+    return n;
+}
+
+/* same head arriving piece bytes at a time: rescan the tail for the empty line, parse once it is there */
+static int old_parse_pieces(char *buf, size_t len, size_t piece, arena_t *arena) {
+    size_t have = 0, scan;
+    char c;
+
+    while (have < len) {
+        scan = have > 3 ? have - 3 : 0;
+        have = have + piece < len ? have + piece : len;
+        c = buf[have];
+        buf[have] = '\0';
+        if (strstr(buf + scan, "\r\n\r\n") != NULL) {
+            buf[have] = c;
+            return old_parse(buf, have, arena);
+        }
+        buf[have] = c;
+    }
+    return -1;
+}
+
+static int new_parse_pieces(const char *buf, size_t len, size_t piece, reqparse_t *p) {
+    size_t have = 0;
+    int rc = REQPARSE_AGAIN;
+
+    reqparse_init(p);
+    while (rc == REQPARSE_AGAIN && have < len) {
+        have = have + piece < len ? have + piece : len;
+        rc = reqparse_feed(p, buf, have);
+    }
+    return rc == REQPARSE_DONE ? p->nheaders : -1;
+}
+
+static const char *lines[] = {
+    "GET http://localhost:18080/home.html HTTP/1.1\r\n",
+    "Host: localhost:18080\r\n",
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/105.0.0.0 Safari/537.36\r\n",
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n",
+    "Accept-Encoding: gzip, deflate\r\n",
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=en-US; tracking=off\r\n",
+    "Connection: keep-alive\r\n",
+    "\r\n",
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* parse the head iters times, piece 0 means the whole head at once; returns the header lines seen */
+static long run(int new, char *buf, size_t len, long iters, size_t piece, arena_t *arena, reqparse_t *p) {
+    long i, total = 0;
+    int n;
+
+    for (i = 0; i < iters; i++) {
+        arena_reset(arena);
+        if (new) {
+            if (piece) {
+                n = new_parse_pieces(buf, len, piece, p);
+            } else {
+                reqparse_init(p);
+                n = reqparse_feed(p, buf, len) == REQPARSE_DONE ? p->nheaders : -1;
+            }
+        } else {
+            n = piece ? old_parse_pieces(buf, len, piece, arena) : old_parse(buf, len, arena);
+        }
+        if (n < 0)
+            return -1;
+        total += n;
+    }
+    return total;
+}
+
+/* scan block[0..len) for lines and colons rounds times, best round in ms; *sum checks the scanners agree */
+static double scan_only(const char *block, size_t len, int rounds, unsigned long *sum) {
+    hdrscan_line_t found[16];
+    hdrscan_t s;
+    double t0, t, tbest = 1e30;
+    int round, i, k;
+
+    *sum = 0;
+    for (round = 0; round < 3; round++) {
+        t0 = now_ms();
+        for (i = 0; i < rounds; i++) {
+            hdrscan_start(&s, 0);
+            while ((k = hdrscan_lines(&s, block, len, found, 16)) > 0)
+                *sum += found[k - 1].nl + found[k - 1].colon;
+        }
+        if ((t = now_ms() - t0) < tbest)
+            tbest = t;
+    }
+    return tbest;
+}
+
+/* best of 3 rounds in ms */
+static double best(int new, char *buf, size_t len, long iters, size_t piece, arena_t *arena, reqparse_t *p,
+                   long *headers) {
+    double t0, t, tbest = 1e30;
+    int round;
+
+    run(new, buf, len, iters / 10, piece, arena, p);
+    for (round = 0; round < 3; round++) {
+        t0 = now_ms();
+        *headers = run(new, buf, len, iters, piece, arena, p);
+        if ((t = now_ms() - t0) < tbest)
+            tbest = t;
+    }
+    return tbest;
+}
+
+int main(int argc, char **argv) {
+    size_t target = (argc > 1 ? atol(argv[1]) : 256) << 20, piece = argc > 2 ? atol(argv[2]) : 16, len = 0;
+    char buf[MAXLINE];
+    static reqparse_t parser;
+    bufpool_t pool;
+    arena_t arena;
+    long iters, hold, hnew, hold_p, hnew_p;
+    double told, tnew, told_p, tnew_p;
+    size_t i;
+    int impl, top;
+    static char block[65536];
+    size_t block_len = 0;
+    unsigned long sum, sum0 = 0;
+    double tscan;
+
+    for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        memcpy(buf + len, lines[i], strlen(lines[i]));
+        len += strlen(lines[i]);
+    }
+    iters = target / len;
+    bufpool_init(&pool);
+    arena_init(&arena, &pool);
+
+    told = best(0, buf, len, iters, 0, &arena, &parser, &hold);
+    told_p = best(0, buf, len, iters, piece, &arena, &parser, &hold_p);
+    printf("%zu byte head, %ld heads, %ld header lines\n", len, iters, hold);
+    printf("strstr + strtok_r,         whole head:    %8.1f ms %6.2f GB/s %6.1f ns/head\n",
+           told, iters * len / told / 1e6, told * 1e6 / iters);
+    printf("strstr + strtok_r,         %3zu byte pieces: %8.1f ms %6.2f GB/s %6.1f ns/head\n",
+           piece, told_p, iters * len / told_p / 1e6, told_p * 1e6 / iters);
+    // the header lines alone, many times over, show what the scanner itself does
+    for (i = 0; block_len + len < sizeof(block); i = (i + 1) % 6) {
+        memcpy(block + block_len, lines[1 + i], strlen(lines[1 + i]));
+        block_len += strlen(lines[1 + i]);
+    }
+    top = hdrscan_init(HDRSCAN_AVX2);
+    for (impl = HDRSCAN_SCALAR; impl <= top; impl++) {
+        hdrscan_init(impl);
+        tscan = scan_only(block, block_len, 2000, &sum);
+        if (impl == HDRSCAN_SCALAR)
+            sum0 = sum;
+        tnew = best(1, buf, len, iters, 0, &arena, &parser, &hnew);
+        tnew_p = best(1, buf, len, iters, piece, &arena, &parser, &hnew_p);
+        if (hold < 0 || hold != hnew || hold_p != hnew_p || sum != sum0) {
+            fprintf(stderr, "parse_bench mismatch with %s: old %ld %ld header lines, new %ld %ld\n",
+                    hdrscan_name(impl), hold, hold_p, hnew, hnew_p);
+            return 1;
+        }
+        printf("hdrscan_lines %-6s,      %zu byte block: %6.1f ms %6.2f GB/s\n",
+               hdrscan_name(impl), block_len, tscan, 2000.0 * block_len / tscan / 1e6);
+        printf("reqparse_feed %-6s,      whole head:    %8.1f ms %6.2f GB/s %6.1f ns/head  speedup %.1fx\n",
+               hdrscan_name(impl), tnew, iters * len / tnew / 1e6, tnew * 1e6 / iters, told / tnew);
+        printf("reqparse_feed %-6s,      %3zu byte pieces: %8.1f ms %6.2f GB/s %6.1f ns/head  speedup %.1fx\n",
+               hdrscan_name(impl), piece, tnew_p, iters * len / tnew_p / 1e6, tnew_p * 1e6 / iters, told_p / tnew_p);
+    }
+    arena_release(&arena);
+    bufpool_deinit(&pool);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * rio_bench - micro-benchmark of rio_readlineb against the original
+ *     byte-at-a-time version. Both read the same HTTP-like text (request
+ *     lines, headers and a few long lines) from a temp file.
+ *
+ *     usage: ./rio_bench [MB of input, default 64]
+ */
+#include "../csapp.h"
+
+/* the original rio_read/rio_readlineb pair, kept here as the baseline */
+static ssize_t old_rio_read(rio_t *rp, char *usrbuf, size_t n) {
+    int cnt;
+
+    while (rp->rio_cnt <= 0) {
+        rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
+        if (rp->rio_cnt < 0) {
+            if (errno != EINTR)
+                return -1;
+        } else if (rp->rio_cnt == 0)
+            return 0;
+        else
+            rp->rio_bufptr = rp->rio_buf;
+    }
+    cnt = n;
+    if (rp->rio_cnt < n)
+        cnt = rp->rio_cnt;
+    memcpy(usrbuf, rp->rio_bufptr, cnt);
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+
+static ssize_t old_rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
+    int n, rc;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+        if ((rc = old_rio_read(rp, &c, 1)) == 1) {
+            *bufp++ = c;
+            if (c == '\n') {
+                n++;
+                break;
+            }
+        } else if (rc == 0) {
+            if (n == 1)
+                return 0;
+            else
+                break;
+        } else
+            return -1;
+    }
+    *bufp = 0;
+    return n - 1;
+}
+
+static const char *lines[] = {
+    "GET http://localhost:18080/home.html HTTP/1.1\r\n",
+    "Host: localhost:18080\r\n",
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/105.0.0.0 Safari/537.36\r\n",
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n",
+    "Accept-Encoding: gzip, deflate\r\n",
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=en-US; tracking=off\r\n",
+    "Connection: keep-alive\r\n",
+    "\r\n",
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* read the whole file line by line, returns bytes read and fills nlines / checksum */
+static size_t run(int fd, ssize_t (*readline)(rio_t *, void *, size_t), long *nlines, unsigned long *sum) {
+    static rio_t rio;
+    char buf[MAXLINE];
+    size_t total = 0;
+    ssize_t n;
+
+    lseek(fd, 0, SEEK_SET);
+    rio_readinitb(&rio, fd);
+    *nlines = 0;
+    *sum = 0;
+    while ((n = readline(&rio, buf, MAXLINE)) > 0) {
+        total += n;
+        (*nlines)++;
+        *sum = *sum * 31 + (unsigned char) buf[n - 1] + n;
+    }
+    return total;
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/rio_benchXXXXXX";
+    size_t target = (argc > 1 ? atol(argv[1]) : 64) << 20, written = 0, len;
+    long nold, nnew;
+    unsigned long sold, snew;
+    double t0, told, tnew;
+    size_t bold, bnew;
+    int fd, i = 0, round;
+
+    if ((fd = mkstemp(path)) < 0)
+        unix_error("mkstemp error");
+    unlink(path);
+    while (written < target) {
+        len = strlen(lines[i]);
+        Rio_writen(fd, (void *) lines[i], len);
+        written += len;
+        i = (i + 1) % (sizeof(lines) / sizeof(lines[0]));
+    }
+
+    // one warm up round each so both runs read from the page cache
+    run(fd, old_rio_readlineb, &nold, &sold);
+    run(fd, rio_readlineb, &nnew, &snew);
+    told = tnew = 1e30;
+    for (round = 0; round < 3; round++) {
+        t0 = now_ms();
+        bold = run(fd, old_rio_readlineb, &nold, &sold);
+        if (now_ms() - t0 < told)
+            told = now_ms() - t0;
+        t0 = now_ms();
+        bnew = run(fd, rio_readlineb, &nnew, &snew);
+        if (now_ms() - t0 < tnew)
+            tnew = now_ms() - t0;
+    }
+    if (bold != bnew || nold != nnew || sold != snew) {
+        fprintf(stderr, "rio_bench mismatch: old %zu bytes %ld lines, new %zu bytes %ld lines\n",
+                bold, nold, bnew, nnew);
+        return 1;
+    }
+    printf("%zu bytes, %ld lines\n", bnew, nnew);
+    printf("byte-at-a-time rio_readlineb: %8.1f ms %8.1f MB/s %6.1f ns/line\n",
+           told, bold / told / 1e3, told * 1e6 / nold);
+    printf("memchr rio_readlineb:         %8.1f ms %8.1f MB/s %6.1f ns/line\n",
+           tnew, bnew / tnew / 1e3, tnew * 1e6 / nnew);
+    printf("speedup %.1fx\n", told / tnew);
+    Close(fd);
+    return 0;
+}
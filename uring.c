@@ -0,0 +1,139 @@
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t *ring, unsigned int entries, unsigned int flags)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+    if ((ring->ring_fd = io_uring_setup(entries, &p)) < 0)
+        return -1;
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        /* Both rings live in one mapping */
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_size);
+            goto fail;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ptr != ring->sq_ptr)
+            munmap(ring->cq_ptr, ring->cq_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        goto fail;
+    }
+
+    sq = ring->sq_ptr;
+    cq = ring->cq_ptr;
+    ring->sq_entries = p.sq_entries;
+    ring->sq_head = (unsigned int *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+    ring->cq_head = (unsigned int *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    close(ring->ring_fd);
+    return -1;
+}
+
+void uring_deinit(uring_t *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    Close(ring->ring_fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+    unsigned int tail, idx;
+    struct io_uring_sqe *sqe;
+
+    tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        /* Ring is full, hand the queued entries to the kernel */
+        while (io_uring_enter(ring->ring_fd, ring->to_submit, 0, 0) < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                unix_error("uring_get_sqe io_uring_enter error");
+        }
+        ring->to_submit = 0;
+    }
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t *ring, unsigned int wait_nr)
+{
+    int n;
+
+    if ((n = io_uring_enter(ring->ring_fd, ring->to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0)) < 0)
+        return -1;
+    ring->to_submit -= n;
+    return n;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+    unsigned int head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register(uring_t *ring, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return io_uring_register(ring->ring_fd, opcode, arg, nr_args) < 0 ? -1 : 0;
+}
@@ -0,0 +1,70 @@
+/* $begin uring.h */
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <linux/io_uring.h>
+#include "csapp.h"
+
+/**
+ * minimal io_uring instance driven through the raw syscalls, the
+ * submission and completion rings are mmap'ed once by uring_init
+ */
+typedef struct uring_t {
+    int ring_fd;
+    unsigned int sq_entries;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned int to_submit;    /* sqes queued since the last io_uring_enter */
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} uring_t;
+
+/**
+ * set up a ring with the given number of submission entries
+ * @return 0 on success, -1 with errno set when io_uring is not usable
+ */
+int uring_init(uring_t *ring, unsigned int entries, unsigned int flags);
+
+/**
+ * unmap the rings and close the ring fd
+ */
+void uring_deinit(uring_t *ring);
+
+/**
+ * reserve the next submission entry, zeroed. If the submission ring is
+ * full the queued entries are pushed to the kernel first.
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/**
+ * submit every queued sqe and wait for at least wait_nr completions
+ * in one io_uring_enter
+ * @return number of sqes consumed, -1 with errno set on failure
+ */
+int uring_submit_and_wait(uring_t *ring, unsigned int wait_nr);
+
+/**
+ * return the next ready completion or NULL, the entry stays valid until
+ * uring_cqe_seen is called
+ */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+void uring_cqe_seen(uring_t *ring);
+
+/**
+ * io_uring_register(2) on the ring (buffer rings, fixed files ...)
+ * @return 0 on success, -1 with errno set on failure
+ */
+int uring_register(uring_t *ring, unsigned int opcode, void *arg, unsigned int nr_args);
+
+#endif /* __URING_H__ */
+/* $end uring.h */